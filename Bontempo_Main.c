@@ -42,9 +42,11 @@
 #define F_CPU 8000000UL
 #include <util/delay.h>
 #include <avr/eeprom.h>
-#include <math.h>
+#include <stdlib.h>
 #include <avr/interrupt.h>
 #include <avr/pgmspace.h>
+#include <avr/sleep.h>
+#include <util/crc16.h>
 
 #define LEDPORT PORTB		//Defining every pin, DDR & port used
 #define LEDPIN	PINB0
@@ -78,21 +80,190 @@
 #define DEPTHPIN PINA3
 #define DEPTHBV 3
 #define N_ARRAY 256
-#define DEBOUNCE_TIME 800	//Tap button debounce time in microseconds
-#define RAND_MAX 0x7fff
-#define PI 3.14159265
-
-volatile unsigned long timevalue;
-volatile uint8_t divtogglevalue;
-volatile uint16_t msturns = 0;
-volatile uint16_t ledturns = 0;
-volatile uint8_t inc = 0;
+#define DEBOUNCE_TIME 800	//Pull-up settling time in microseconds before the switches are first read
+#define MENU_IDLE 0			//states of the long press menus
+#define MENU_CLEAN 1
+#define MENU_RECAL 2
+#define MENU_RECALL1 3
+#define MENU_RECALL2 4
+#define MENU_SAVE1 5
+#define MENU_SAVE2 6
+#define MENU_CANCEL 7
+#define MENU_CONFIRM 8
+#define MENU_PICK 9
+#define PICK_WAIT 1500		//ms without a tap, once the slot number has blinked, before the preset menu ends
+#define JOURNAL_START 256	//tempo journal : ring of 4 byte records (tap, mstempo, sequence) in the upper half of the eeprom
+#define JOURNAL_SLOTS 64
+#define JOURNAL_IDLE 1000	//ms without change before the tempo is written
+#define PRESET_START 16		//preset bank : PRESETS records of struct preset, up to the legacy offsets at 96
+#define PRESETS 8
+#define PRESET_VERSION 1	//any other version byte is an empty slot
+#define ADC_TIME 0			//pots & toggles conditioning channels
+#define ADC_DIV 1
+#define ADC_SPEED 2
+#define ADC_DEPTH 3
+#define ADC_WAVE 4
+#define ADC_OVERSAMPLE 4	//10-bit conversions of a pot summed for each filtered sample
+#define ADC_STEPS 16		//length of the scan sequence, power of 2
+#define ADC_SMOOTH 2		//low-pass strength, each filtered sample moves the value by 1/2^ADC_SMOOTH of the difference
+#define TOGGLE_LOW 200		//10-bit toggle reading below which it is in its first position
+#define TOGGLE_HIGH 920		//above which it is in its third position, middle position in between
+#define CAL_STEPS 40		//calibration correction curve points, every 32ms from 51ms
+#define CAL_FIRST 3			//first and last calibration points, point n is measured at (n+1)*100ms
+#define CAL_LAST 11
+#define CAL_ZERO 250		//no correction below this tempo, as in the original firmware (its offsets 0 to 2 were never calibrated)
+#define GLIDE_SNAP 2		//wiper moves of this many steps or less are not glided
+#define GLIDE_TAP 40		//wiper glide times in ms : new tap tempo, division or double time
+#define GLIDE_POT 15		//delay time pot (the pot itself already moves gradually)
+#define GLIDE_PRESET 250	//preset recall
+#define TASKS 6				//scheduler table length
+#define BLOCK_RUNS 40		//pot task runs (every 5ms) ignoring the time pot, div toggle and tap after startup or a preset recall
+#define TAP_WINDOW 4		//number of tap intervals kept for the tempo estimate
+#define TAPDEBOUNCE 5		//Tap button edges closer than this (in ms) to the last accepted one are bounces
+#define DIVONE 96			//divmult value of a quarter note, divisions are stored in 96ths
+#define DIVS 6				//time divisions on the toggle, 3 plain & 3 with the tap button held
+
+struct preset		//preset bank record, read & written as one block
+{
+	uint8_t version;
+	uint8_t tap;
+	uint8_t wave;
+	uint8_t div;		//divindex, double time is taken from the switch on recall
+	uint16_t tempo;		//mstempo : tempo in tap control, wiper position in pot control
+	uint8_t depth;
+	uint8_t speed;
+	uint16_t crc;		//crc16 of the fields above
+};
+struct preset menuundo;		//slot content before the menu saved over it, written back if a tap steps to the next slot
+
+//Shared between the main loop and the interrupts (the LFO settings & pwm targets are further down with the LFO) :
+//none of them is read or written with interrupts disabled except the tap latch, each group says why a read is never torn
+
+//Tap latch : written by taplatch() only, from the pin change interrupt or from debounce() with interrupts off, so an edge is latched once
+volatile uint8_t tapstate = 0;	//debounced tap button state, single byte
+volatile uint32_t tapedge = 0;	//us timestamp of the last accepted tap button edge, only read by taplatch()
+volatile uint32_t taptime = 0;	//us timestamp of the last tap button press, gettap() reads it until two reads match
+
+//Wiper queue, main loop to LFO interrupt : SPI_Queue() clears spiflag while it writes the glide, the interrupt only takes it when spiflag is 1
+volatile uint8_t spipending;		//last wiper position queued by the main loop
+volatile uint16_t spirate;			//glide speed to it, in 1/256 wiper steps per ms
+volatile uint8_t spiflag = 0;		//1 when spipending has not been looked at by the LFO interrupt
+volatile uint8_t wipernow = 0;		//wiper position on the pot, for the glide length : written by the interrupt, single byte
+volatile uint8_t spirequests = 0;	//wiper writes asked by the main loop, stops at 255 : written by the main loop, single byte
+volatile uint16_t spiwrites = 0;	//wiper writes actually sent on the bus : written by the interrupt, only read by the host benchmark
+
+//ADC outputs : single bytes written by the ADC interrupt, adcmoved() clears the change flag before the value is read so no change is lost
+volatile uint8_t timevalue;
+volatile uint8_t divtogglevalue;	//div toggle position, 0 to 2
 volatile uint8_t speedvalue;
-volatile unsigned long depthvalue;
-volatile uint8_t wavevalue;
-volatile unsigned long currentinc = 500;
-volatile uint16_t pwm;
-volatile uint16_t speed;
+volatile uint8_t depthvalue;
+volatile uint8_t wavevalue;		//waveform toggle position, 0 to 2
+volatile uint8_t adcchanged[5];		//set by the ADC interrupt when a channel stable value changes, cleared by the main loop
+volatile uint8_t adcprimed = 0;		//one bit per channel, set once the filter holds a first sample, only read by the main loop
+
+uint16_t spilast = 0x100;			//last wiper position sent to the digital pot (none yet)
+uint8_t wipertarget;				//wiper position the glide heads to
+uint16_t wiperpos;					//gliding wiper position, 8.8 bits
+uint16_t wiperrate;					//glide speed in 1/256 steps per ms
+
+uint8_t blinkcount = 0;		//steps left in the current LED blink pattern
+uint8_t blinkperiod;		//ms between 2 LED toggles
+uint16_t blinknext;			//msclock of the next step
+uint8_t menu = MENU_IDLE;	//current long press menu stage
+uint8_t menuslot;			//preset slot recalled or saved in MENU_PICK
+uint8_t menusave;			//1 : the slot is saved, 0 : recalled
+uint8_t menupress;			//tap button state last seen in MENU_PICK
+uint32_t tapintervals[TAP_WINDOW];	//last tap intervals in us
+uint8_t tapcount = 0;		//intervals in tapintervals
+uint8_t tapnext = 0;		//where the next interval goes
+uint32_t tapheld = 0;		//interval far from the tempo, kept aside until the next one tells if it's a new tempo, 0 if none
+uint32_t tapestimate;		//tempo estimate in us
+uint8_t journalslot = 0;	//slot of the latest tempo journal record
+uint8_t journalbuf[4];		//latest record : tap, mstempo low & high bytes, sequence number
+uint8_t journalstep = 4;	//bytes of journalbuf already written, 4 when no write is going on
+uint8_t journaldirty = 0;	//tempo changed since the last record
+uint8_t journaltap;			//tempo waiting to be written
+uint16_t journaltempo;
+struct calibration		//everything calbuild() loads from the calibration saved in EEPROM
+{
+	int16_t curve[CAL_STEPS];	//correction in ms every 32ms from 51ms
+	uint16_t delaymax;			//maximum tempo, 600ms in clean mode
+};
+struct calibration cal;
+int8_t pwmtrim = 0;			//mod pwm bias fine tuning the delay between two wiper steps
+uint16_t journaltime;		//msclock of the last tempo change
+uint16_t menuend;			//msclock when the current menu stage times out
+uint16_t tapstart;			//msclock of the last tap or button press, for the tap timeouts and the long press
+uint16_t beatstart;			//msclock of the last LED downbeat
+
+uint16_t mstempo;		//tempo for toggling LED (not influenced by tempo div)
+uint16_t nbtap = 0;		//number of times tapped during the current sequence
+uint8_t laststate = 0;	//last state of the button
+uint8_t tap;		//tap controlled (1) or pot controlled (0)
+uint8_t tapping = 0;	//led follow tap (1) or follow tempo (0)
+uint8_t data;	//to store digital pot wiper position
+uint8_t previoustimevalue;	//to know if the time pot moved
+uint8_t previousdiv = 0xFF;	//to know if the div toggle moved, no position so that div is checked at startup
+uint8_t divmult = DIVONE;		//the div tempo multiplicand, in 96ths
+uint8_t divindex = 0;		//time division selected, position in divisions[]
+uint8_t cachewiper[2*DIVS];	//wiper position of each division for the current tempo, plain & double time
+int8_t cachetrim[2*DIVS];	//pwmtrim going with each cached wiper position
+uint16_t cacheclamp;		//one bit per cached division, set when its time was over delaymax
+uint8_t previouswave = 0xFF;	//to know if waveform toggle moved, no position so that waveform is checked at startup
+uint8_t cleanmode;
+uint8_t block = 0; //is used for delaying the time and tap button read at startup, (the eeprom time save is not taken into account otherwise)
+uint8_t speedpresetactive = 0;	//is the speed preset value used?
+uint8_t depthpresetactive = 0;	//is the depth preset value used?
+uint8_t timepresetactive = 0;	//is the depth preset value used?
+uint8_t presetspeed;	//for storing preset values
+uint8_t presetdepth;
+uint8_t previousspeed;	//for detecting if speed pot moved
+uint8_t lfospeed = 0;		//speed value currently applied to the LFO
+uint8_t previouslfospeed = 0;
+uint8_t previousdepth;	//for detecting if depth pot moved
+uint8_t previousdoubletime; //for detecting if double time pin changed state
+uint32_t lasttaptime = 0;	//us timestamp of the previous tap
+uint8_t doublestate;	//debounced double time switch state
+uint8_t doubleraw;		//double time switch state at the last read
+
+volatile uint8_t inc = 0;		//position in wavetable (top byte of the phase accumulator)
+volatile uint32_t phase = 0;	//LFO phase accumulator
+uint32_t phaseinc = 524288;		//added to phase every LFO sample, sets mod speed
+uint8_t wavetype = 0;			//this value selects one of the 7 waveforms
+uint8_t randomtype = 6;			//random waveform selected last : 5 stepped, 6 smooth
+uint16_t randseed = 0xACE1;		//xorshift PRNG state, never 0
+uint16_t randfrom = 200;		//random waveform values at the start and end of the current phase segment
+uint16_t randto = 200;
+uint16_t adcfilter[5];				//low-passed value of each channel, 12-bit with 4 fractional bits
+uint8_t adcvalue[5];				//stable 8-bit value of each pot, position of each toggle
+uint16_t adcsum[5];					//sum of the conversions of each channel
+uint8_t adccount[5];
+uint8_t adcstep = 0;				//position in the scan sequence
+uint16_t moddepth = 0;				//mod depth scaled to 0-256
+uint16_t pwmoffset = 300;			//mod pwm value when the waveform is at its lowest
+
+struct lfosettings		//LFO settings the main loop hands to the LFO interrupt
+{
+	uint32_t phaseinc;
+	uint16_t depth;
+	uint16_t offset;
+	uint8_t wave;
+	uint16_t syncperiod;	//ms between two phase resets in tempo sync, 0 when free running
+};
+struct lfosettings lfo[2];			//double buffer : the interrupt reads lfo[lforead], the main loop fills the other one
+volatile uint8_t lforead = 0;
+volatile uint16_t pwmtarget[2] = {19660, 19660};	//mod pwm duty in 1/256 steps of the 8-bit pwm, dithered by the timer1 overflow
+volatile uint8_t pwmread = 0;		//byte offset of the pwmtarget the interrupt reads (0 or 2), the LFO interrupt fills the other one
+uint8_t pwmerror = 0;			//fraction of a step not output yet
+volatile uint8_t mshigh = 0;	//top byte of the 32-bit ms count, above the 3 bytes in GPIOR0-2 : ms * 1000 then wraps with the 32-bit us count
+volatile uint8_t syncreset = 0;	//1 asks the LFO interrupt to restart the phase on this sample (downbeat)
+uint16_t synccount = 0;			//LFO samples since the last phase reset
+uint8_t lfosync = 0;			//LFO speed locked to the tempo (1) or set by the speed pot (0)
+uint8_t syncspeed;				//speed pot value when the sync ratio was picked
+uint8_t syncratio = 0xFF;		//sync ratio in use, see syncratios[]
+uint16_t syncbeat = 0;			//beat in ms the sync period was computed for
+uint16_t syncperiod = 0;		//ms between two LFO phase resets, 0 when free running
+uint8_t syncalign = 0;			//1 : restart the LFO phase on the next LED downbeat
 
 PROGMEM const uint16_t tempo[] = {	//wiper position to tempo conversion chart
 			51,52,54,59,65,71,77,83,89,94,99,105,110,115,120,125,131,136,141,146,
@@ -109,26 +280,110 @@ PROGMEM const uint16_t tempo[] = {	//wiper position to tempo conversion chart
 			1129,1133,1138,1142,1147,1152,1157,1162,1166,1171,1175,1180,1185,1189,1194,1199,1203,1208,1212,1217,
 			1222,1226,1231,1236,1241,1245,1250,1254,1259,1264,1268,1273,1277,1282,1287,1291};
 
-uint8_t debounce(void)					//tells with certainty if button is pressed
+PROGMEM const uint8_t tempoindex[] = {	//highest wiper position with a tempo below each 16ms step from 51ms, to start findClosest() near the target
+			0,4,7,10,13,16,19,22,25,27,31,34,37,40,43,46,50,53,56,59,
+			62,65,68,71,75,78,81,84,88,91,94,98,101,104,107,111,114,117,120,124,
+			127,130,134,137,141,144,147,151,154,157,161,164,167,171,174,178,181,184,188,191,
+			194,198,201,205,208,211,215,218,222,225,229,232,236,239,242,246,249,253};
+
+//finetrim[] is computed, not measured : the original pwmfine[] steps (5 pwm steps per ms shortening, 4.6 lengthening, at 500ms) scaled as 1/delay.
+//The calibration routine only measures wiper delays, so on a pedal the trim is as good as that model (see test/finetrim.c).
+PROGMEM const int8_t finetrim[] = {	//mod pwm bias making up a -3 to +3ms difference between the target and the wiper tempo, one row per 16 wiper positions
+			84,56,28,0,-26,-52,-78,	43,29,14,0,-13,-27,-40,	29,19,10,0,-9,-18,-27,	22,15,7,0,-7,-14,-20,
+			18,12,6,0,-5,-11,-16,	15,10,5,0,-5,-9,-14,	13,9,4,0,-4,-8,-12,		11,8,4,0,-4,-7,-11,
+			10,7,3,0,-3,-6,-9,		9,6,3,0,-3,-6,-9,		8,6,3,0,-3,-5,-8,		8,5,3,0,-2,-5,-7,
+			7,5,2,0,-2,-4,-7,		7,5,2,0,-2,-4,-6,		6,4,2,0,-2,-4,-6,		6,4,2,0,-2,-4,-5};
+
+PROGMEM const uint8_t sine[] = {	//first quarter of a 256 step sine wave, 200 amplitude
+			0,5,10,15,20,24,29,34,39,44,49,53,58,63,67,72,77,81,86,90,
+			94,99,103,107,111,115,119,123,127,131,134,138,141,145,148,151,155,158,161,164,
+			166,169,172,174,176,179,181,183,185,187,188,190,191,193,194,195,196,197,198,198,
+			199,199,200,200,200};
+
+PROGMEM const uint8_t adcsequence[] = {	//channel converted at each 1ms trigger : pots often, toggles once every 16ms
+			ADC_TIME,ADC_SPEED,ADC_DEPTH,ADC_TIME,ADC_DIV,ADC_TIME,ADC_SPEED,ADC_DEPTH,
+			ADC_TIME,ADC_SPEED,ADC_DEPTH,ADC_TIME,ADC_WAVE,ADC_TIME,ADC_SPEED,ADC_DEPTH};
+
+PROGMEM const uint8_t adcmux[] = {	//ADMUX value of each channel
+			0x00,0x01,0x02,0x03,0x07};	//time, div toggle, speed, depth, wave toggle
+
+PROGMEM const uint8_t adchysteresis[] = {	//pots : extra move (in 12-bit steps) needed outside the current 8-bit step before the value changes, toggles : 10-bit margin past TOGGLE_LOW/HIGH
+			6,16,6,6,16};	//time, div toggle, speed, depth, wave toggle
+
+PROGMEM const uint16_t rate[] = {	//one octave of LFO phase increments, 32 steps
+			32768,33486,34219,34968,35734,36516,37316,38133,38968,39821,40693,41584,42495,43425,44376,45348,
+			46341,47356,48393,49452,50535,51642,52773,53928,55109,56316,57549,58809,60097,61413,62757,64132};
+
+PROGMEM const uint8_t divisions[] = {	//divmult of each time division : fourth, dotted eighth, eighth, triplet, sixteenth, sextuplet
+	DIVONE, (DIVONE*3)/4, DIVONE/2, DIVONE/3, DIVONE/4, DIVONE/6
+};
+PROGMEM const uint8_t syncratios[] = {	//beats & LFO cycles per sync period, picked by the speed pot in tempo sync
+			4,1, 2,1, 1,1, 1,2, 1,3, 1,4, 1,6, 1,8};
+
+//--------HARDWARE ABSTRACTION
+//Pins, timer and PWM registers are only touched through these, so the tempo & modulation code stays portable.
+//SPI is SPI_Transmit(), ADC samples arrive through ISR(ADC_vect), EEPROM uses the avr-libc eeprom_* calls.
+//test/host provides these headers for a Linux build of the whole file, the 2 hand written interrupts have a C version for it.
+
+static inline void ledon(void){LEDPORT |= (1<<LEDPIN);}
+
+static inline void ledoff(void){LEDPORT &= ~(1<<LEDPIN);}
+
+static inline void ledtoggle(void){LEDPORT ^= (1<<LEDPIN);}
+
+static inline uint8_t tappin(void){return(bit_is_clear(BUTTONSFR,BUTTONBV));}	//tap button pressed (active low)
+
+static inline uint8_t doublepin(void){return(bit_is_set(DOUBLESFR,DOUBLEBV) != 0);}	//double time switch on
+
+static inline uint16_t timerus(void){return(TCNT0 << 3);}	//microseconds elapsed in the current ms, 8us steps
+
+static inline uint16_t msclock(void){return(GPIOR0 | ((uint16_t)GPIOR1 << 8));}	//free running ms counter, never reset : low 16 bits of the 32-bit count kept in GPIOR0-2 & mshigh by the ms tick
+
+static inline uint32_t msclock32(void){return(GPIOR0 | ((uint16_t)GPIOR1 << 8) | ((uint32_t)GPIOR2 << 16) | ((uint32_t)mshigh << 24));}
+
+static inline uint8_t timerpending(void){return((TIFR0 & (1<<OCF0B)) != 0);}	//ms tick not serviced yet
+
+static inline void pwmwrite(uint16_t duty)	//mod pwm duty cycle, 0 to 999 (scaled by 65.53 to 8.8 bits for the dithering)
 {
-	if (bit_is_clear(BUTTONSFR,BUTTONBV))		//if button pressed
-	{
-		_delay_us(DEBOUNCE_TIME);				//wait debounce time
-		if (bit_is_clear(BUTTONSFR,BUTTONBV))	//if still pressed return 1
-		{
-			return(1);
-		}
-		else									//if not return 0
-		{
-			return(0);
-		}
-	}
-	else
+	uint8_t next = pwmread ^ 2;
+	
+	pwmtarget[next >> 1] = (duty << 6) + duty + (duty >> 1) + (duty >> 5);
+	pwmread = next;		//single byte write : the dithering interrupt reads the old or the new target, never a mix of both
+}
+
+uint32_t usnow(void)		//us timestamp, called with interrupts disabled, wraps every 71.6 minutes without a jump since the ms count is 32 bits
+{
+	uint16_t us = timerus();
+	uint32_t ms = msclock32();
+	
+	if (timerpending() && us < 500){ms++;}	//timer0 wrapped since the interrupt was blocked
+	return((ms << 10) - (ms << 4) - (ms << 3) + us);	//ms * 1000 without a multiply
+}
+
+void taplatch(void)		//latches a tap button edge with its timestamp, called with interrupts disabled
+{
+	uint32_t now;
+	uint8_t pressed = tappin();
+	
+	if (pressed == tapstate){return;}	//no edge : no timestamp needed, keeps debounce() short
+	
+	now = usnow();
+	if (now - tapedge >= TAPDEBOUNCE * 1000UL)	//ignore bounces following an accepted edge
 	{
-		return(0);
+		tapstate = pressed;
+		tapedge = now;
+		if (pressed){taptime = now;}
 	}
 }
 
+uint8_t debounce(void)					//tells with certainty if button is pressed, without waiting
+{
+	cli();			//the pin change interrupt must not latch the same edge in the middle of this one
+	taplatch();		//catches a release or press that came during the bounce time of the previous edge
+	sei();
+	return(tapstate);
+}
+
 int getClosest(int, int, int, int, int); 
   
 // Returns element closest to target in arr[] and return wiper position
@@ -140,40 +395,18 @@ int findClosest(int target)
     if (target >= pgm_read_word_near(tempo + (N_ARRAY-1))) 
         return N_ARRAY - 1; 
   
-    // Doing binary search 
-    int i = 0, j = N_ARRAY, mid = 0; 
-    while (i < j) { 
-        mid = (i + j) / 2; 
-  
-        if (pgm_read_word_near(tempo + mid) == target) 
-            return mid; 
-  
-        /* If target is less than array element, 
-            then search in left */
-        if (target < pgm_read_word_near(tempo + mid)) { 
-  
-            // If target is greater than previous 
-            // to mid, return closest of two 
-            if (mid > 0 && target > pgm_read_word_near(tempo + (mid - 1))) 
-                return getClosest(pgm_read_word_near(tempo + (mid - 1)), 
-                                  pgm_read_word_near(tempo + mid), target, mid-1, mid); 
+    // Start from the 16ms bucket holding the target, 
+    // then step up at most 4 positions to the pair around it 
+    uint8_t n = pgm_read_byte_near(tempoindex + ((target - 51) >> 4)); 
+    uint16_t below = pgm_read_word_near(tempo + n); 
+    uint16_t above; 
   
-            /* Repeat for left half */
-            j = mid; 
-        } 
-  
-        // If target is greater than mid 
-        else { 
-            if (mid < N_ARRAY - 1 && target < pgm_read_word_near(tempo + (mid + 1))) 
-                return getClosest(pgm_read_word_near(tempo + mid), 
-                                  pgm_read_word_near(tempo + (mid + 1)), target, mid, mid+1); 
-            // update i 
-            i = mid + 1;  
-        } 
+    while ((above = pgm_read_word_near(tempo + (n + 1))) <= target) { 
+        n++; 
+        below = above; 
     } 
   
-    // Only single element left after search 
-    return mid; 
+    return getClosest(below, above, target, n, n+1); 
 } 
   
 // Method to compare which one is the more close. 
@@ -190,6 +423,154 @@ int getClosest(int val1, int val2,
         return n1; 
 } 
 
+void calbuild(void)		//loads the calibration : delaymax and the curve interpolated between the points saved every 100ms
+{
+	uint8_t i, k;
+	uint16_t t;
+	int16_t below, above;
+	
+	cal.delaymax = eeprom_read_word((uint16_t*)100);
+	
+	for (i = 0; i < CAL_STEPS; i++)
+	{
+		t = 51 + 32*i;
+		k = t / 100;
+		if (t < CAL_ZERO){cal.curve[i] = 0;}
+		else if (k <= CAL_FIRST){cal.curve[i] = eeprom_read_word((uint16_t *)(160 + 2*CAL_FIRST));}	//up to the first point : held from CAL_ZERO like the original offsets
+		else if (k > CAL_LAST){cal.curve[i] = eeprom_read_word((uint16_t *)(160 + 2*CAL_LAST));}	//above the last point : held
+		else
+		{
+			below = eeprom_read_word((uint16_t *)(160 + 2*(k - 1)));
+			above = eeprom_read_word((uint16_t *)(160 + 2*k));
+			cal.curve[i] = below + ((int32_t)(above - below) * (t - 100*k)) / 100;
+		}
+	}
+}
+
+int16_t calcorrect(uint16_t target)	//calibration correction for a tempo, linear between the curve points
+{
+	uint8_t i;
+	uint8_t frac;
+	
+	if (target < 51){target = 51;}
+	i = (target - 51) >> 5;
+	if (i >= CAL_STEPS - 1){return(cal.curve[CAL_STEPS - 1]);}
+	frac = (target - 51) & 31;
+	return(cal.curve[i] + (((cal.curve[i+1] - cal.curve[i]) * frac) >> 5));
+}
+
+uint8_t tapwiper(uint16_t target, int8_t *trim)	//wiper position closest to a calibrated tempo, the difference left is made up by the mod pwm bias stored in trim
+{
+	uint8_t wiper;
+	
+	target += calcorrect(target);
+	wiper = findClosest(target);
+	int16_t delta = target - pgm_read_word_near(tempo + wiper);
+	
+	if (delta > 3){delta = 3;}		//outside the chart
+	if (delta < -3){delta = -3;}
+	*trim = pgm_read_byte_near(finetrim + (wiper >> 4) * 7 + delta + 3);
+	return(wiper);
+}
+
+uint16_t randomstep(void)	//16-bit xorshift PRNG step, returns a random waveform value (0 to 397)
+{
+	uint8_t value;
+	
+	randseed ^= randseed << 7;
+	randseed ^= randseed >> 9;
+	randseed ^= randseed << 8;
+	value = randseed >> 8;
+	return(value + (value >> 1) + (value >> 4));	//value * 400/256 without a multiply
+}
+
+uint16_t wavesample(uint8_t wavetype, uint8_t phase)	//returns waveform value (0 to 400) at a position in the wavetable
+{
+	uint8_t quarter = phase & 63;
+	
+	switch (wavetype)
+	{
+		case 0:		//Sine, rebuilt from the quarter wave table
+		if (phase & 64){quarter = 64 - quarter;}
+		if (phase & 128){return(200 - pgm_read_byte_near(sine + quarter));}
+		return(200 + pgm_read_byte_near(sine + quarter));
+		
+		case 1:		//Square
+		if (phase <= 127){return(0);}
+		return(400);
+		
+		case 2:		//Triangle
+		if (phase <= 127){return(3 * phase);}
+		return(3 * (255 - phase));
+		
+		case 3:		//Sawtooth
+		return(phase);
+		
+		default:	//Reverse Sawtooth
+		return(255 - phase);
+	}
+}
+
+void SPI_Queue(uint8_t data, uint16_t glide)		//queues a wiper position reached in glide ms, the LFO interrupt steps the wiper to it
+{
+	uint8_t distance = (data > wipernow) ? data - wipernow : wipernow - data;
+	uint16_t rate = 0xFFFF;		//snap
+	
+	if (distance > GLIDE_SNAP && glide != 0)
+	{
+		rate = ((uint16_t)distance << 8) / glide;
+		if (rate == 0){rate = 1;}
+	}
+	
+	spiflag = 0;			//flag cleared during the update and set after it : the interrupt never reads a half queued glide
+	spipending = data;
+	spirate = rate;
+	spiflag = 1;
+	if (spirequests != 255){spirequests++;}
+}
+
+void lfopublish(void)		//hands the LFO settings to the interrupt without disabling it
+{
+	struct lfosettings *next = &lfo[lforead ^ 1];
+	
+	next->phaseinc = phaseinc;
+	next->depth = moddepth;
+	next->offset = pwmoffset;
+	next->wave = wavetype;
+	next->syncperiod = syncperiod;
+	lforead ^= 1;		//single byte write : the interrupt sees either the old or the new settings, never a mix
+}
+
+uint32_t lforate(uint8_t speed)	//phase increment for a speed pot value, 6 octaves from 0.12Hz to 7.7Hz
+{
+	uint8_t n = (speed * 3) >> 2;
+	
+	return((uint32_t)pgm_read_word_near(rate + (n & 31)) << ((n >> 5) + 4));
+}
+
+uint16_t divide(uint16_t ms, uint8_t divmult)	//applies a time division to a tempo, rounded to the nearest ms
+{
+	return(((uint32_t)ms * divmult + (DIVONE / 2)) / DIVONE);
+}
+
+uint16_t undivide(uint16_t ms, uint8_t divmult)	//tempo giving a divided time of ms
+{
+	return(((uint32_t)ms * DIVONE) / divmult);
+}
+
+int16_t floattofixed(uint32_t f, uint8_t fracbits)	//converts a float saved by older firmware to fixed point, without the float library
+{
+	int8_t shift = (int8_t)((f >> 23) & 0xFF) - 127 - 23 + fracbits;
+	uint32_t mantissa = (f & 0x7FFFFF) | 0x800000;
+	
+	if ((f & 0x7F800000) == 0 || shift <= -24){return(0);}	//zero or too small
+	if (shift < 0){mantissa >>= -shift;}
+	else{mantissa = 0x7FFF;}	//too big, never happens with stored values
+	
+	if (f & 0x80000000){return(-(int16_t)mantissa);}
+	return(mantissa);
+}
+
 void SPI_Transmit(uint8_t data)			//function to transmit 8 bit digital pot wiper position via the SPI
 {
 	USIDR = 0b00010011;					//command byte  : write to all pots
@@ -208,728 +589,1248 @@ void SPI_Transmit(uint8_t data)			//function to transmit 8 bit digital pot wiper
 	CSPORT |= (1<<CSPIN);				//Chip select pin set high after 16 clock cycles: transmission complete
 }
 
-void blink1(void)		//toggles led to verify interactions
+uint16_t getms(void)		//reads msclock without disabling interrupts, read again if the ms tick came in between
 {
-	LEDPORT ^= (1<<LEDPIN);
-	_delay_ms(150);
-	LEDPORT ^= (1<<LEDPIN);
-	_delay_ms(150);
+	uint16_t ms;
+	do{ms = msclock();}
+	while (ms != msclock());
+	return(ms);
 }
 
-void fastblink1(void)		//toggles led to verify interactions
+uint32_t getus(void)		//reads the us clock without disabling interrupts, timer0 is never reset so differences of timestamps are elapsed times
 {
-	LEDPORT ^= (1<<LEDPIN);
-	_delay_ms(100);
-	LEDPORT ^= (1<<LEDPIN);
-	_delay_ms(100);
+	uint16_t us;
+	uint32_t ms;
+	
+	do		//the ms count is read again if the tick came in between
+	{
+		ms = msclock32();
+		us = timerus();
+	}
+	while (ms != msclock32() || timerpending());	//tick or overflow not serviced yet in between : read again
+	return((ms << 10) - (ms << 4) - (ms << 3) + us);
 }
 
-uint8_t doubletime(void)
+uint32_t gettap(void)		//reads the last tap timestamp without disabling interrupts
+{
+	uint32_t t;
+	do{t = taptime;}
+	while (t != taptime);
+	return(t);
+}
+
+uint16_t blink(uint8_t toggles, uint8_t period, uint16_t wait)	//starts toggling the led to verify interactions, returns the pattern length in ms
+{
+	blinkcount = toggles + 1;	//last step only waits for the end of the pattern
+	blinkperiod = period;
+	blinknext = getms() + wait;
+	return(wait + toggles * period);
+}
+
+uint8_t blinking(void)		//advances the blink pattern without waiting, returns 1 while it owns the LED
 {
-	if (bit_is_set(DOUBLESFR,DOUBLEBV))		//if button pressed
+	uint16_t now = getms();
+	
+	while (blinkcount != 0 && (int16_t)(now - blinknext) >= 0)
 	{
-		_delay_us(DEBOUNCE_TIME);				//wait debounce time
-		if (bit_is_set(DOUBLESFR,DOUBLEBV)){return(1);}	//if still pressed return 1
-		else{return(0);}	//if not return 0
+		if (blinkcount > 1){ledtoggle();}
+		blinkcount--;
+		blinknext += blinkperiod;
 	}
-	else{return(0);}
+	return(blinkcount != 0);
 }
 
-void Timerinit(void)
+void menustage(uint8_t stage, uint16_t length)	//enters a menu stage that times out after length ms
+{
+	menu = stage;
+	menuend = getms() + length;
+}
+
+uint8_t menuexpired(void)
+{
+	return((int16_t)(getms() - menuend) >= 0);
+}
+
+void beatled(uint16_t period)	//flashes the LED on every beat of period ms, beats are counted from the last one so they don't drift
 {
-	TCNT0 = 0;				//timer0, fast PWM, OCRA as TOP, enable compare A interrupt, 1024 prescaler
-	OCR0A = 100;
-	TCCR0A |= (1<<WGM00) | (1<<WGM01);
-	TIMSK0 |= (1<<OCIE0A);
-	TCCR0B |= (1<<WGM02) | (1<<CS02) | (1<<CS00);
+	uint16_t now = getms();
 	
-	ICR1 = 999;	//timer1, fast PWM, ICR1 as TOP, enable overflow interrupt and compare A interrupt, no prescaler
-	TCNT1 = 0;
+	if ((uint16_t)(now - beatstart) >= period)	//turns LED on every downbeat
+	{
+		beatstart += period;
+		if ((uint16_t)(now - beatstart) >= period){beatstart = now;}	//more than a beat late : restart from now
+		ledon();
+		if (syncalign == 1)		//synced LFO joins the beat
+		{
+			syncalign = 0;
+			syncreset = 1;
+		}
+	}
 	
-	OCR1A = 300;
-	TCCR1A |= (1<<COM1A1);
-	TIMSK1 |= (1<<OCIE1A);
+	if ((uint16_t)(now - beatstart) >= 8){ledoff();}	//turns LED off 8ms after downbeat
+}
+
+uint32_t tapmedian(void)	//robust mean of the tap intervals : median of 3, mean of the 2 middle ones of 4
+{
+	uint32_t sorted[TAP_WINDOW];
+	uint32_t swap;
+	uint8_t i, k;
 	
-	TCCR1A |= (1<<WGM11);
-	TIMSK1 |= (1<<TOIE1);
-	TCCR1B |= (1<<WGM12) | (1<<WGM13) | (1<<CS11);
+	for (i = 0; i < tapcount; i++)	//insertion sort, 4 values at most
+	{
+		swap = tapintervals[i];
+		for (k = i; k > 0 && sorted[k-1] > swap; k--){sorted[k] = sorted[k-1];}
+		sorted[k] = swap;
+	}
+	
+	if (tapcount & 1){return(sorted[tapcount >> 1]);}
+	return((sorted[(tapcount >> 1) - 1] + sorted[tapcount >> 1] + 1) >> 1);
 }
 
-void IOinit(void)
+void tapadd(uint32_t interval)	//adds a tap interval and updates tapestimate
 {
-	LEDDDR |= (1<<LEDPIN);	//LED pins as output
-	PWMDDR |= (1<<PWMPIN);	//PWM pin as output
-	SPIDDR |= (1<<CLKPIN) | (1<<DATAPIN); //SPI pins as output
-	CSDDR |= (1<<CSPIN);
+	uint32_t deviation;
 	
-	BUTTONPORT |= (1<<BUTTONPIN); //Connecting Pull-Up Resistors
-	MODPORT |= (1<<WAVEPIN);
-	DIVPORT |= (1<<DIVPIN);
-	CSPORT |= (1<<CSPIN);	//Chip select pin high (not selected)
+	if (tapcount != 0)
+	{
+		deviation = (interval > tapestimate) ? interval - tapestimate : tapestimate - interval;
+		
+		if (deviation > (tapestimate >> 2))	//more than 25% off the tempo
+		{
+			if (tapheld == 0)	//single sloppy tap : left out of the estimate
+			{
+				tapheld = interval;
+				return;
+			}
+			tapcount = 0;		//two in a row : new tempo, restart from both
+			tapnext = 0;
+			tapintervals[tapnext++] = tapheld;
+			tapcount++;
+		}
+	}
+	
+	tapheld = 0;
+	tapintervals[tapnext] = interval;
+	tapnext = (tapnext + 1) % TAP_WINDOW;
+	if (tapcount < TAP_WINDOW){tapcount++;}
+	tapestimate = tapmedian();
 }
 
-void ADCinit(void)
+uint8_t journalread(void)	//finds the latest tempo journal record at startup, returns 0 if the journal is empty
 {
-	ADCSRA |= (1<<ADEN) | (1<<ADIE) | (1<<ADPS2) | (1<<ADPS1) | (1<<ADPS0); //Enabling ADC, 16 prescaler, ADC interrupts enable
-	ADCSRB |= (1<<ADLAR); //8bit conversion
+	uint8_t seq = eeprom_read_byte((uint8_t *)(JOURNAL_START + 3));
+	uint8_t next;
+	
+	journalslot = 0;
+	while (journalslot < JOURNAL_SLOTS - 1)		//records follow each other until the oldest one
+	{
+		next = eeprom_read_byte((uint8_t *)(JOURNAL_START + 4*(journalslot + 1) + 3));
+		if (next != (uint8_t)(seq + 1)){break;}
+		seq = next;
+		journalslot++;
+	}
+	eeprom_read_block(journalbuf, (const void *)(JOURNAL_START + 4*journalslot), 4);
+	journaltap = journalbuf[0];
+	journaltempo = journalbuf[1] | (journalbuf[2] << 8);
+	return(journaltap <= 1);	//erased eeprom reads 0xFF
 }
 
-ISR(ADC_vect)					//ADC interrupt
+void journalchange(uint8_t tap, uint16_t mstempo)	//marks the tempo to be saved once it stops changing
 {
-	switch(ADMUX)
+	if (tap != journaltap || mstempo != journaltempo)
 	{
-		case 0x00:
-		timevalue = ADCH;		//Stocking 8-bit value
-		ADMUX |= (1<<MUX0);		//changing to next ADC Channel
-		break;
-	
-		case 0x01:
-		divtogglevalue = ADCH;
-		ADMUX &= ~(1<<MUX0);
-		ADMUX |= (1<<MUX1);
-		break;
-		
-		case 0x02:
-		speedvalue = ADCH;
-		ADMUX |= (1<<MUX0);
-		break;
+		journaltap = tap;
+		journaltempo = mstempo;
+		journaldirty = 1;
+		journaltime = getms();
+	}
+}
+
+void journaltask(void)	//writes the tempo journal one byte at a time, only when the eeprom is ready
+{
+	if (journalstep < 4)
+	{
+		if (eeprom_is_ready())
+		{
+			eeprom_update_byte((uint8_t *)(JOURNAL_START + 4*journalslot + journalstep), journalbuf[journalstep]);	//sequence number written last
+			journalstep++;
+		}
+	}
 	
-		case 0x03:
-		depthvalue = ADCH;
-		ADMUX |= (1<<MUX2);
-		break;
-		
-		case 0x07:
-		wavevalue = ADCH;
-		ADMUX &= ~(1<<MUX0) & ~(1<<MUX1) & ~(1<<MUX2);
-		break;
+	else if (journaldirty == 1 && (uint16_t)(getms() - journaltime) >= JOURNAL_IDLE)
+	{
+		journaldirty = 0;
+		if (journaltap != journalbuf[0] || journaltempo != (journalbuf[1] | (journalbuf[2] << 8)))
+		{
+			journalbuf[0] = journaltap;
+			journalbuf[1] = journaltempo;
+			journalbuf[2] = journaltempo >> 8;
+			journalbuf[3]++;
+			journalslot = (journalslot + 1) % JOURNAL_SLOTS;
+			journalstep = 0;
+		}
 	}
-	ADCSRA |= (1<<ADSC);	//Restarting conversion
 }
 
-ISR(TIM1_OVF_vect)
+void doubleread(void)	//debounces the double time switch without waiting : a state counts once read twice in a row, a pot task period apart
 {
-	msturns++;	//ms increment if timer1 overflow
-	ledturns++;
+	uint8_t pin = doublepin();
+	
+	if (pin == doubleraw){doublestate = pin;}
+	doubleraw = pin;
 }
 
-ISR(TIM1_COMPA_vect)
+uint8_t doubletime(void)
 {
-	cli();		//updates mod pwm duty cycle
-	OCR1A = pwm;
-	sei();
+	return(doublestate);
 }
 
-ISR(TIM0_COMPA_vect)
+void wipercache(void)	//wiper position & pwm trim of every division for the current tempo, so a div or double time change is a lookup
 {
-	inc++;		//increment position in wavetable
-	cli();
-	OCR0A = speed;	//update mod speed
-	sei();
+	uint8_t i;
+	uint16_t target;
+	
+	cacheclamp = 0;
+	for (i = 0; i < 2*DIVS; i++)	//even entries plain, odd entries double time
+	{
+		target = divide(mstempo, pgm_read_byte_near(divisions + (i >> 1)) >> (i & 1));
+		if (target > cal.delaymax)
+		{
+			target = cal.delaymax;
+			cacheclamp |= 1 << i;
+		}
+		cachewiper[i] = tapwiper(target, &cachetrim[i]);
+	}
 }
 
-int main(void)
-{	
-	_delay_ms(1000); //Waiting for PT2399 to start-up
+void cachesend(uint8_t glide)	//sends the cached wiper position of the current division & double time, so every path agrees with the cache
+{
+	uint8_t i = (divindex << 1) | doubletime();
 	
-	IOinit();
-	Timerinit();
-	ADCinit();
+	data = cachewiper[i];
+	pwmtrim = cachetrim[i];
+	SPI_Queue(data, glide);
 	
-	uint16_t divtempo;		//The current tempo tapped (it will  be multiplied by the tempo div)
-	uint16_t mstempo = eeprom_read_word((uint16_t*)2);		//tempo for toggling LED (not influenced by tempo div)
-	//uint8_t delaymin = 51;
-	uint16_t delaymax = eeprom_read_word((uint16_t*)100);	//maximum tempo if not in clean mode
-	uint16_t offset;
-	//int8_t pwmfine[] = {25,21,16,11,6,0,-7,-11,-15,-19,-23};	//pwm values for +-5ms offset
-	//int8_t delta;
-	unsigned long cleantimevalue;
+	if (cacheclamp & (1 << i))	//time over delaymax : the tempo is brought down to it and the cache follows, after the wiper is queued
+	{
+		mstempo = undivide(cal.delaymax, divmult);
+		wipercache();
+	}
+}
+
+void divapply(void)	//tap control : sends the cached wiper position of the current division & double time
+{
+	divmult = pgm_read_byte_near(divisions + divindex) >> doubletime();
+	if (tap != 1){return;}
+	cachesend(GLIDE_TAP);
+}
+
+uint8_t divfind(uint8_t mult)	//division of a saved divmult (saved with or without double time), fourth if unknown
+{
+	uint8_t i;
+	
+	for (i = 0; i < DIVS; i++)
+	{
+		if (pgm_read_byte_near(divisions + i) == mult){return(i);}
+	}
+	for (i = 0; i < DIVS; i++)
+	{
+		if (pgm_read_byte_near(divisions + i) == (mult << 1)){return(i);}
+	}
+	return(0);
+}
+
+uint16_t presetcrc(struct preset *p)	//crc16 of a preset record, the crc field excluded
+{
+	uint8_t *bytes = (uint8_t *)p;
+	uint16_t crc = 0xFFFF;
+	uint8_t i;
 	
-	uint16_t nbtap = 0;		//number of times tapped during the current sequence
-	uint8_t laststate = 0;	//last state of the button
-	uint8_t tap = eeprom_read_byte((uint8_t*)1);		//tap controlled (1) or pot controlled (0)
-	uint8_t tapping = 0;	//led follow tap (1) or follow tempo (0)
+	for (i = 0; i < sizeof(struct preset) - 2; i++){crc = _crc16_update(crc, bytes[i]);}
+	return(crc);
+}
+
+uint8_t presetread(uint8_t slot, struct preset *p)	//reads a preset slot, returns 0 if it was never saved or is corrupted
+{
+	eeprom_read_block(p, (const void *)(PRESET_START + slot * sizeof(struct preset)), sizeof(struct preset));
+	return(p->version == PRESET_VERSION && p->div < DIVS && p->crc == presetcrc(p));
+}
+
+void presetsave(uint8_t slot)	//saves the current settings to a preset slot, only the bytes that changed are written
+{
+	struct preset p;
 	
-	uint8_t data;	//to store digital pot wiper position
+	p.version = PRESET_VERSION;
+	p.tap = tap;
+	p.wave = wavetype;
+	p.div = divindex;
+	p.tempo = mstempo;
+	p.depth = depthvalue;
+	p.speed = speedvalue;
+	p.crc = presetcrc(&p);
+	eeprom_update_block(&p, (void *)(PRESET_START + slot * sizeof(struct preset)), sizeof(struct preset));
+}
+
+uint8_t presetrecall(uint8_t slot)	//recalls a preset slot, the wiper is queued before anything else is updated ; returns 0 if the slot is empty
+{
+	struct preset p;
 	
-	uint8_t previoustimevalue;	//to know if the time pot moved
-	uint16_t previousdiv = 900;	//to know if the div toggle moved, set >255+50 so that div is checked at startup
-	float divmult = 1;				//the div tempo multiplicand
+	if (presetread(slot, &p) == 0){return(0);}
 	
-	uint16_t previouswave = 900;	//to know if waveform toggle moved, set >255+50 so that waveform is checked at startup
-	uint8_t wavetype = 0;			//this value selects one of the 6 waveforms
+	tap = p.tap;
+	mstempo = p.tempo;
+	divindex = p.div;
+	divmult = pgm_read_byte_near(divisions + divindex) >> doubletime();	//double time applied before the division, for every slot
+	if (tap == 1)
+	{
+		wipercache();
+		cachesend(GLIDE_PRESET);
+	}
+	else
+	{
+		data = mstempo;
+		SPI_Queue(data, GLIDE_PRESET);
+	}
+	wavetype = p.wave;
+	presetdepth = p.depth;
+	presetspeed = p.speed;
+	speedpresetactive = 1;
+	depthpresetactive = 1;
+	timepresetactive = 1;
+	previousdepth = depthvalue;
+	previousspeed = speedvalue;
+	block = 0;	//Blocking delay time pot and tap button to make it stable
+	return(1);
+}
+
+void presetmigrate(uint8_t floats)	//moves the 2 presets of older firmware (32-45 & 64-77) to the first bank slots, once ; floats : divisions still saved as floats
+{
+	struct preset p[2];
+	uint8_t i;
+	uint8_t mult;
 	
-	uint8_t cleanmode = eeprom_read_byte((uint8_t*)0);	//read clean mode status from eeprom
+	for (i = 0; i < PRESETS; i++)
+	{
+		if (presetread(i, &p[0])){return;}	//bank already in use : the legacy addresses are bank bytes now
+	}
 	
-	uint16_t block = 0; //is used for delaying the time and tap button read at startup, (the eeprom time save is not taken into account otherwise) 
+	for (i = 0; i < 2; i++)		//both read before the bank, which overlaps them, is written
+	{
+		if (floats){mult = (floattofixed(eeprom_read_dword((uint32_t *)(35 + 32*i)), 8) * DIVONE + 128) >> 8;}
+		else{mult = eeprom_read_byte((uint8_t *)(35 + 32*i));}
+		p[i].version = (eeprom_read_byte((uint8_t *)(32 + 32*i)) == 1) ? PRESET_VERSION : 0;
+		p[i].tap = eeprom_read_byte((uint8_t *)(33 + 32*i));
+		p[i].wave = eeprom_read_byte((uint8_t *)(34 + 32*i));
+		p[i].div = divfind(mult);
+		p[i].tempo = eeprom_read_word((uint16_t *)(39 + 32*i));
+		p[i].depth = eeprom_read_byte((uint8_t *)(41 + 32*i));	//low byte of the depth dword
+		p[i].speed = eeprom_read_byte((uint8_t *)(45 + 32*i));
+		p[i].crc = presetcrc(&p[i]);
+	}
+	for (i = 0; i < 2; i++)
+	{
+		if (p[i].version == PRESET_VERSION){eeprom_update_block(&p[i], (void *)(PRESET_START + i * sizeof(struct preset)), sizeof(struct preset));}
+	}
+}
+
+void Timerinit(void)
+{
+	TCNT0 = 0;				//timer0, CTC, OCRA as TOP, enable compare A & B interrupts, 64 prescaler : 1kHz LFO sample rate and ms tick
+	OCR0A = 124;
+	OCR0B = OCR0A;			//ms tick flag rises on the clock clearing TCNT0 (one clock after the match), so TCNT0 counts the time since the tick
+	TCCR0A |= (1<<WGM01);
+	TIMSK0 |= (1<<OCIE0A) | (1<<OCIE0B);
+	TCCR0B |= (1<<CS01) | (1<<CS00);
 	
-	uint8_t speedpresetactive = 0;	//is the speed preset value used?
-	uint8_t depthpresetactive = 0;	//is the depth preset value used?
-	uint8_t timepresetactive = 0;	//is the depth preset value used?
-	uint8_t presetspeed;	//for storing preset values
-	uint32_t presetdepth;
-	uint8_t previousspeed;	//for detecting if speed pot moved
-	uint32_t previousdepth;	//for detecting if depth pot moved
-	uint8_t previousdoubletime = doubletime(); //for detecting if double time pin changed state
+	TCNT1 = 0;	//timer1, fast PWM 8-bit, enable overflow interrupt, no prescaler : 31.25kHz mod pwm
 	
-	uint8_t calibrated = eeprom_read_byte((uint8_t *)200);	//reads if already calibrated
-	float timecal;
-	float useroffset[13]={0,0,0,0,0,0,0,0,0,0,0,0,0};	//array of manual calibration for every 100ms
-	uint8_t j = 0;
+	OCR1A = 76;
+	TCCR1A |= (1<<COM1A1);
 	
+	TCCR1A |= (1<<WGM10);
+	TIMSK1 |= (1<<TOIE1);
+	TCCR1B |= (1<<WGM12) | (1<<CS10);
+}
 
-//--------CLEAN MODE & RE-CALIBRATION 
-
-		if (debounce()==1)
-		{
-			LEDPORT &= ~(1<<LEDPIN);
-			blink1();			//if pressed long enough blink
-			
-			for (uint16_t c = 0; c < 2000; c++ )	//if button released during the 2s following the blinking
-			{
-				_delay_ms(1);
-				if (debounce() == 0)
-				{
-					switch (cleanmode)
-					{
-						case 0x01:					//toggle the clean mode state and store it to eeprom
-						cleanmode = 0;
-						eeprom_update_byte((uint8_t*)0,0);
-						break;
-						
-						default:
-						cleanmode = 1;
-						eeprom_update_byte((uint8_t*)0,1);
-						break;
-					}
-					_delay_ms(150);
-					fastblink1();
-					_delay_ms(150);
-					break;
-				}
-			}
-			if (debounce()==1)
-			{
-				blink1();
-				blink1();
-				for (uint16_t c = 0; c < 2000; c++ )	//if button released during the 2s following the blinking
-				{
-					_delay_ms(1);
-					if (debounce() == 0)
-					{
-						calibrated = 0;
-						_delay_ms(150);
-						fastblink1();
-						fastblink1();
-						_delay_ms(150);
-						break;
-					}
-				}
-			}
-		}
-		
-		
-	sei();			//activating interrupts
+void IOinit(void)
+{
+	LEDDDR |= (1<<LEDPIN);	//LED pins as output
+	PWMDDR |= (1<<PWMPIN);	//PWM pin as output
+	SPIDDR |= (1<<CLKPIN) | (1<<DATAPIN); //SPI pins as output
+	CSDDR |= (1<<CSPIN);
+	
+	BUTTONPORT |= (1<<BUTTONPIN); //Connecting Pull-Up Resistors
+	MODPORT |= (1<<WAVEPIN);
+	DIVPORT |= (1<<DIVPIN);
+	CSPORT |= (1<<CSPIN);	//Chip select pin high (not selected)
+	
+	GIMSK |= (1<<PCIE1);	//tap button pin change interrupt
+	PCMSK1 |= (1<<PCINT9);
+	_delay_us(DEBOUNCE_TIME);	//let the pull-up settle before reading the button
+	tapstate = tappin();
+	doubleraw = doublepin();
+	doublestate = doubleraw;
+	set_sleep_mode(SLEEP_MODE_IDLE);	//timers, ADC & pin change keep running while the CPU waits for work
+}
+
+void ADCinit(void)
+{
+	ADMUX = pgm_read_byte_near(adcmux + pgm_read_byte_near(adcsequence + 0));
+	ADCSRB |= (1<<ADTS1) | (1<<ADTS0);	//conversions triggered by timer0 compare A (1kHz)
+	ADCSRA |= (1<<ADEN) | (1<<ADIE) | (1<<ADATE) | (1<<ADPS2) | (1<<ADPS1) | (1<<ADPS0); //Enabling ADC, auto trigger, 128 prescaler, ADC interrupts enable, 10bit conversion
+}
+
+uint8_t adccondition(uint8_t channel, uint16_t sum)	//low-pass & hysteresis on an oversampled channel, returns its stable 8-bit value
+{
+	uint8_t bit = 1 << channel;
+	uint8_t value = adcvalue[channel];
+	uint16_t level;
 	
-	ADCSRA |= (1<<ADSC); //Starting first AD conversion
+	if ((adcprimed & bit) == 0)		//first sample : no ramp from 0 at power up
+	{
+		adcprimed |= bit;
+		adcfilter[channel] = sum << 4;
+		value = sum >> 4;
+		adcvalue[channel] = value;
+		return(value);
+	}
 	
-	//-------------CALIBRATION
+	adcfilter[channel] += (sum << (4 - ADC_SMOOTH)) - (adcfilter[channel] >> ADC_SMOOTH);
+	level = adcfilter[channel] >> 4;	//12-bit
 	
-	if (calibrated != 13)
+	if (level > (value << 4) + 15 + pgm_read_byte_near(adchysteresis + channel) || level + pgm_read_byte_near(adchysteresis + channel) < (value << 4))
 	{
-		delaymax = 1291;
-		j=0;
-		calibrated = 3;
-		pwm = 300;
-		while(calibrated!=13)
+		value = level >> 4;
+		adcvalue[channel] = value;
+		adcchanged[channel] = 1;
+	}
+	return(value);
+}
+
+uint8_t adctoggle(uint8_t channel, uint16_t level)	//3 position toggle from an unfiltered 10-bit reading, returns its position (0 to 2)
+{
+	uint8_t bit = 1 << channel;
+	uint8_t position = adcvalue[channel];
+	uint8_t hysteresis = pgm_read_byte_near(adchysteresis + channel);
+	
+	if ((adcprimed & bit) == 0)		//first reading : no position to hold yet
+	{
+		adcprimed |= bit;
+		position = (level < TOGGLE_LOW) ? 0 : ((level > TOGGLE_HIGH) ? 2 : 1);
+		adcvalue[channel] = position;
+		return(position);
+	}
+	
+	if (position != 0 && level + hysteresis < TOGGLE_LOW){position = 0;}	//a flip jumps straight to the new position, no filter to ramp through the middle one
+	else if (position != 2 && level > TOGGLE_HIGH + hysteresis){position = 2;}
+	else if (position != 1 && level > TOGGLE_LOW + hysteresis && level + hysteresis < TOGGLE_HIGH){position = 1;}
+	
+	if (position != adcvalue[channel])
+	{
+		adcvalue[channel] = position;
+		adcchanged[channel] = 1;
+	}
+	return(position);
+}
+
+uint8_t adcmoved(uint8_t channel)	//tells if the channel stable value changed since the last call
+{
+	if (adcchanged[channel] == 0){return(0);}
+	adcchanged[channel] = 0;	//a change coming in between is merged with this one, the value is read after
+	return(1);
+}
+
+ISR(ADC_vect)					//ADC interrupt
+{
+	uint8_t channel = pgm_read_byte_near(adcsequence + adcstep);
+	uint8_t value;
+	
+	if (channel == ADC_DIV || channel == ADC_WAVE)	//toggles : one conversion tells the position, no oversampling or low-pass
+	{
+		value = adctoggle(channel, ADC);
+		if (channel == ADC_DIV){divtogglevalue = value;}
+		else{wavevalue = value;}
+	}
+	else
+	{
+		adcsum[channel] += ADC;
+		
+		if (++adccount[channel] == ADC_OVERSAMPLE)
 		{
-			timecal=timevalue;
-			
-			if(calibrated<=11){
-				mstempo = (calibrated+1)*100;
-				useroffset[calibrated] = ((timecal * (mstempo/3)) / 255) - (mstempo/6);
-				//if (mstempo + useroffset[calibrated] > delaymax){useroffset[calibrated] = delaymax - findClosest(mstempo);} //no overflow in useroffset
-				data = findClosest(mstempo + useroffset[calibrated]);
-				SPI_Transmit(data);
-				}
-				
-			else{
-				SPI_Transmit(255);
-				delaymax = 1491 - ((timecal*400)/255);
-				mstempo = delaymax;
-			}
+			value = adccondition(channel, adcsum[channel]);
+			adcsum[channel] = 0;
+			adccount[channel] = 0;
 			
-			if (ledturns >= mstempo - 4)	//turns LED on every downbeat
+			switch(channel)		//Stocking stable 8-bit value
 			{
-				ledturns = 0;
-				LEDPORT |= (1<<LEDPIN);
-			}
-			
-			if (ledturns >= 8){LEDPORT &= ~(1<<LEDPIN);}	//turns LED off 4ms after downbeat
-			
-			if (laststate == 1 && debounce()==0){laststate =0;}
+				case ADC_TIME:
+				timevalue = value;
+				break;
 				
-			if (debounce()==1 && laststate == 0)
-			{
-				laststate = 1;
-				calibrated++;
+				case ADC_SPEED:
+				speedvalue = value;
+				break;
+				
+				default:
+				depthvalue = value;
+				break;
 			}
 		}
-		for (uint8_t i= 96; i<=144; i+=4)	//stocks all useroffset to eeprom
-		{
-			eeprom_update_float((float *)i, useroffset[j]);
-			j++;
-		}
-		eeprom_update_byte((uint8_t *)200, 13); //stocks calibrated status to eeprom
-		eeprom_update_word((uint16_t*)100, delaymax); //stocks delaymax to eeprom
 	}
 	
+	adcstep = (adcstep + 1) & (ADC_STEPS - 1);
+	ADMUX = pgm_read_byte_near(adcmux + pgm_read_byte_near(adcsequence + adcstep));	//next channel, converted at the next trigger
+}
+
+ISR(PCINT1_vect)
+{
+	taplatch();	//timestamp the tap at the moment of the edge
+}
+
+//Interrupt cycle budget, vector jump and reti included ; test/isrcycles.sh (make -C test isrcheck) checks the avr-gcc listing against test/isrcycles.txt,
+//callees & loop bounds included. The compiler generated handlers have no figure until it has been run with avr-gcc (./isrcycles.sh --print) :
+//TIM1_OVF	47 cycles every 256 (18% of the CPU), hand written pwm dithering from the pwmtarget buffer in use, may preempt the LFO interrupt
+//TIM0_COMPB	25 cycles (29 when GPIOR0 wraps, 33 when GPIOR1 wraps too, 37 when GPIOR2 wraps too), hand written ms tick, flagged with the LFO interrupt and taken as soon as it re-enables interrupts
+//TIM0_COMPA	interruptible after its first cycles : a 32x16 bit multiply for the pwm and a 16 clock SPI write at most once per ms
+//PCINT1		reads 32-bit ms count & timer0 and shifts it into a us timestamp, only on button edges
+//ADC		one table lookup & sum per conversion, filter & hysteresis every 4th conversion of a channel
+
+#ifdef __AVR__
+ISR(TIM1_OVF_vect, ISR_NAKED)	//first order sigma-delta : the fraction of pwmtarget left over is carried to the next pwm period
+{
+	asm volatile(
+		"push r24"				"\n\t"	//2
+		"in r24, __SREG__"		"\n\t"	//1
+		"push r24"				"\n\t"	//2
+		"push r30"				"\n\t"	//2
+		"push r31"				"\n\t"	//2
+		"lds r30, pwmread"		"\n\t"	//2, Z = pwmtarget buffer in use
+		"ldi r31, 0"			"\n\t"	//1
+		"subi r30, lo8(-(pwmtarget))"	"\n\t"	//1
+		"sbci r31, hi8(-(pwmtarget))"	"\n\t"	//1
+		"ld r24, Z"				"\n\t"	//2, fraction
+		"ldd r31, Z+1"			"\n\t"	//2, 8-bit duty, Z not needed after it
+		"lds r30, pwmerror"		"\n\t"	//2
+		"add r30, r24"			"\n\t"	//1, carry : one more step this period
+		"sts pwmerror, r30"		"\n\t"	//2
+		"brcc 1f"				"\n\t"	//2, 1 on carry
+		"inc r31"				"\n\t"	//1, no overflow : duty stays below 900 of 999
+		"1: ldi r30, 0"			"\n\t"	//1
+		"out %[hi], r30"		"\n\t"	//1, high byte first for the 16-bit write
+		"out %[lo], r31"		"\n\t"	//1, OCR1A buffered, applied at the next period
+		"pop r31"				"\n\t"	//2
+		"pop r30"				"\n\t"	//2
+		"pop r24"				"\n\t"	//2
+		"out __SREG__, r24"		"\n\t"	//1
+		"pop r24"				"\n\t"	//2
+		"reti"					"\n\t"	//4, plus 4 to enter and 2 for the vector jump
+		:: [hi] "I" (_SFR_IO_ADDR(OCR1AH)), [lo] "I" (_SFR_IO_ADDR(OCR1AL))
+	);
+}
+
+ISR(TIM0_COMPB_vect, ISR_NAKED)	//ms tick : 32-bit ms count in GPIOR0-2 & mshigh, only r24 & SREG used
+{
+	asm volatile(
+		"push r24"				"\n\t"	//2
+		"in r24, __SREG__"		"\n\t"	//1
+		"push r24"				"\n\t"	//2
+		"in r24, %[b0]"			"\n\t"	//1
+		"inc r24"				"\n\t"	//1
+		"out %[b0], r24"		"\n\t"	//1
+		"brne 1f"				"\n\t"	//2, 1 on wrap
+		"in r24, %[b1]"			"\n\t"
+		"inc r24"				"\n\t"
+		"out %[b1], r24"		"\n\t"
+		"brne 1f"				"\n\t"
+		"in r24, %[b2]"			"\n\t"
+		"inc r24"				"\n\t"
+		"out %[b2], r24"		"\n\t"
+		"brne 1f"				"\n\t"
+		"lds r24, %[b3]"		"\n\t"	//2
+		"inc r24"				"\n\t"
+		"sts %[b3], r24"		"\n\t"	//2
+		"1: pop r24"			"\n\t"	//2
+		"out __SREG__, r24"		"\n\t"	//1
+		"pop r24"				"\n\t"	//2
+		"reti"					"\n\t"	//4, plus 4 to enter and 2 for the vector jump
+		:: [b0] "I" (_SFR_IO_ADDR(GPIOR0)), [b1] "I" (_SFR_IO_ADDR(GPIOR1)), [b2] "I" (_SFR_IO_ADDR(GPIOR2)), [b3] "i" (&mshigh)
+	);
+}
+#else
+ISR(TIM1_OVF_vect)		//host port (test/host) : same dithering & ms tick as the hand written ones, in C
+{
+	uint16_t target = pwmtarget[pwmread >> 1];
+	uint8_t duty = target >> 8;
+	uint8_t error = pwmerror + (target & 0xFF);
+	
+	if (error < pwmerror){duty++;}
+	pwmerror = error;
+	OCR1A = duty;
+}
+
+ISR(TIM0_COMPB_vect)
+{
+	if (++GPIOR0 == 0 && ++GPIOR1 == 0 && ++GPIOR2 == 0){mshigh++;}
+}
+#endif
+
+ISR(TIM0_COMPA_vect, ISR_NOBLOCK)	//the ms tick and tap edges don't wait for the LFO
+{
+	struct lfosettings *set = &lfo[lforead];	//consistent settings, the main loop only writes the other buffer
+	uint16_t sample;
+	uint8_t previous = inc;
+	
+	if (set->syncperiod != 0 && (syncreset == 1 || ++synccount >= set->syncperiod))	//tempo sync : downbeat or end of the sync period, phase back to the start
+	{
+		syncreset = 0;
+		synccount = 0;
+		phase = 0;
+	}
+	else{phase += set->phaseinc;}		//advance the LFO at a fixed sample rate
+	inc = phase >> 24;		//position in wavetable
+	
+	if (set->wave < 5){sample = wavesample(set->wave, inc);}
 	else
 	{
-		j=0;
-		for(uint8_t i = 96; i<=144; i+=4) //retrieves useroffset from eeprom every power up after calibration
+		if (((inc ^ previous) & 0xC0) != 0)	//new quarter of the LFO cycle : next random value
 		{
-			useroffset[j]=eeprom_read_float((float *)i);
-			j++;
+			randfrom = randto;
+			randto = randomstep();
 		}
+		if (set->wave == 5){sample = randto;}	//stepped random
+		else{sample = randfrom + (((int16_t)(randto - randfrom) * (inc & 63)) >> 6);}	//smooth random : glides to the value over the quarter
 	}
 	
-	if (cleanmode == 1){delaymax = 600;}	//if in clean mode the maximum delay is now 600ms
-	
-	if (tap != 1){SPI_Transmit(mstempo);}
+	pwmwrite((((uint32_t)(100 + sample) * set->depth) >> 8) + set->offset);	//updates mod pwm duty cycle
 	
+	if (spiflag == 1)	//latest queued wiper position & glide speed
+	{
+		spiflag = 0;
+		wipertarget = spipending;
+		wiperrate = spirate;
+		if (spilast > 255){wiperpos = (uint16_t)wipertarget << 8;}	//pot position unknown before the first write : no glide
+	}
 	
-    while (1) 
-    {
-		//---------PWM OUTPUT
-		
+	if (wiperpos != (uint16_t)wipertarget << 8)	//one glide step per ms
+	{
+		uint16_t target = (uint16_t)wipertarget << 8;
 		
-		if (depthpresetactive == 1){offset = (300 - ((presetdepth * 300)/255));}	//updating mod pwm value
+		if (wiperpos < target){wiperpos = (target - wiperpos > wiperrate) ? wiperpos + wiperrate : target;}
+		else{wiperpos = (wiperpos - target > wiperrate) ? wiperpos - wiperrate : target;}
+	}
+	
+	if (spirequests != 0 && (wiperpos + 128) >> 8 != spilast)	//send the wiper position when it moved (nothing before the first queued one), at most once per ms
+	{
+		spilast = (wiperpos + 128) >> 8;
+		SPI_Transmit(spilast);
+		wipernow = spilast;
+		spiwrites++;
+	}
+}
+
+void taskmod(void)		//mod depth, offset, speed & waveform handed to the LFO interrupt
+{
+	uint16_t offset;
+	uint8_t position;		//wave toggle position
+	
+	//---------PWM OUTPUT
+	
+	
+	if (depthpresetactive == 1){offset = (300 - ((presetdepth * 20)/17));}	//updating mod pwm value
 
-		if (depthpresetactive == 0 || abs(depthvalue - previousdepth) >= 13)
+	if (depthpresetactive == 0 || abs(depthvalue - previousdepth) >= 13)
+	{
+		depthpresetactive = 0;
+		offset = (300 - ((depthvalue * 20)/17));	//updating mod pwm value
+	}
+	
+	if (tap == 1)	//compensate with pwm between two wiper steps if tap tempo is active
+	{
+		if (pwmtrim < 0 && offset < (uint8_t)-pwmtrim){offset = 0;}
+		else{offset += pwmtrim;}
+	}
+	
+	if (depthpresetactive == 1){moddepth = presetdepth + (presetdepth >> 7);}	//depth and offset are applied to the waveform in the LFO interrupt
+	else{moddepth = depthvalue + (depthvalue >> 7);}
+	pwmoffset = offset;
+	
+	
+	//-----------MODULATION SPEED & WAVEFORMS
+	
+	if (speedpresetactive == 1){lfospeed = presetspeed;}	//updating mod speed
+		
+	if (speedpresetactive == 0 || abs(speedvalue - previousspeed) >= 13)
+	{
+		speedpresetactive = 0;
+		lfospeed = speedvalue; //updating mod speed
+	}
+	
+	if (debounce() == 0 && lfosync == 0){syncspeed = speedvalue;}	//reference for a move with the tap button held
+	else if (abs(speedvalue - syncspeed) >= 13)
+	{
+		lfosync = debounce();	//turned with the tap button held : LFO synced to the tempo, turned without : free speed again
+		syncspeed = speedvalue;
+		if (lfosync == 1)		//press doesn't count as tap for tap tempo
 		{
-			depthpresetactive = 0;
-			offset = (300 - ((depthvalue * 300)/255));	//updating mod pwm value
+			laststate = 1;
+			nbtap = 0;
+			tapping = 0;
+			tapstart = getms();
 		}
+	}
+	
+	if (lfosync == 1)	//LFO period locked to the beat, the phase increment only changes with the tempo or the ratio
+	{
+		uint16_t beat = (tap == 1) ? mstempo : pgm_read_word_near(tempo + mstempo);	//pot control : delay time of the wiper position
+		uint8_t ratio = syncspeed >> 5;
+		uint32_t period;
 		
-		/*if (tap == 1)
+		if (beat != syncbeat || ratio != syncratio)
 		{
-			delta = divtempo - pgm_read_word_near(tempo + data);	//difference between tempo tapped and closest tempo in conversion chart
-			offset += pwmfine[delta + 5];	//compensate with pwm if tap tempo is active
-		}*/
-		
-		if (depthpresetactive == 1){pwm = (((100 + currentinc) * presetdepth)/255) + offset;}
-			
-		else{pwm = (((100 + currentinc) * depthvalue)/255) + offset;}
-		
-		
-		
+			syncbeat = beat;
+			syncratio = ratio;
+			period = (uint32_t)beat * pgm_read_byte_near(syncratios + 2*ratio);	//a tapped tempo at a short division goes up to 17.9s, 4 of them don't fit 16 bits
+			if (period > 0xFFFF){period = 0xFFFF;}	//phase reset every 65s at most, off the beat only at such tempos
+			if (period == 0){period = 1;}		//no tempo saved yet
+			syncperiod = period;
+			phaseinc = (0xFFFFFFFF / period) * pgm_read_byte_near(syncratios + 2*ratio + 1);
+			if (tap == 1){syncalign = 1;}	//restart on the LED beat
+			else{syncreset = 1;}
+		}
+	}
+	else if (lfospeed != previouslfospeed || syncperiod != 0)	//new phase increment only when the speed changes
+	{
+		syncperiod = 0;
+		syncratio = 0xFF;		//sync computed again when it's turned back on
+		phaseinc = lforate(lfospeed);
+		previouslfospeed = lfospeed;
+	}
+
+	position = wavevalue;
+	if (position != previouswave)	//if wave toggle moves, update waveform
+	{
+		if (debounce() == 0)	//if tap button not pressed use first 3 waveforms
+		{
+			if (position == 0){wavetype = 0;}
 		
-		//-----------MODULATION SPEED & WAVEFORMS
+			if (position == 1){wavetype = 1;}
 		
-		if (speedpresetactive == 1){speed = 255 - presetspeed;}	//updating mod speed
-			
-		if (speedpresetactive == 0 || abs(speedvalue - previousspeed) >= 13)
-		{
-			speedpresetactive = 0;
-			speed = 255 - speedvalue; //updating mod speed
+			if (position == 2){wavetype = 2;}
 		}
-		
-		if (speed < 3){speed = 3;}	//limiting speed, it bugs if lower than 3
 	
-		if (abs(previouswave-wavevalue) > 50)	//if wave toggle moves, update waveform
+		if (debounce() == 1)		//if tap button pressed while moving waveform toggle use alternate waveforms
 		{
-			if (debounce() == 0)	//if tap button not pressed use first 3 waveforms
-			{
-				if (wavevalue <= 50){wavetype = 0;}
-			
-				if (wavevalue > 50 && wavevalue < 230 ){wavetype = 1;}
-			
-				if (wavevalue >= 230){wavetype = 2;}
-			}
+			if (position == 0){wavetype = 3;}
+		
+			if (position == 1){wavetype = 4;}
 		
-			if (debounce() == 1)		//if tap button pressed while moving waveform toggle use alternate waveforms
+			if (position == 2)	//random, stepped and smooth each time it's selected
 			{
-				if (wavevalue <= 50){wavetype = 3;}
-			
-				if (wavevalue > 50 && wavevalue < 230){wavetype = 4;}
-			
-				if (wavevalue >=230){wavetype = 5;}
-					
-				laststate = 1;		//press doesn't count as tap for tap tempo
-				nbtap = 0;
-				tapping = 0;
-				msturns = 0;
+				wavetype = (randomtype == 5) ? 6 : 5;
+				randomtype = wavetype;
 			}
-		
-			previouswave = wavevalue;	//update previouswave for next toggle move
+				
+			laststate = 1;		//press doesn't count as tap for tap tempo
+			nbtap = 0;
+			tapping = 0;
+			tapstart = getms();
 		}
 	
-		//update mod waveform value
-		if (wavetype == 0){currentinc = (int)((sin(((2 * PI) / 255) * inc)*200) + 200);}	//Sine
+		previouswave = position;	//update previouswave for next toggle move
+	}
+
+	lfopublish();
+}
+
+void taskpots(void)		//double time switch, delay time pot & time division toggle
+{
+	uint8_t cleantimevalue;
+	uint8_t timemoved;			//time pot changed since the last run
+	uint8_t position;			//div toggle position
+	
+	//---------DOUBLE TIME
+	
+	doubleread();
+	
+	if (doubletime() != previousdoubletime)
+	{
+		divapply();
+		previousdoubletime = doubletime();
+	}
+	
+	
+	//----------DELAY TIME POT
 	
-		if (wavetype == 1)	//Square
+	timemoved = adcmoved(ADC_TIME);	//time pot stable value changed
+	
+	if(block < BLOCK_RUNS)	//blocks the tap button input, div update and the delay time input for 200ms. This helps stabilizing the save tempo and preset recall.
+	{
+		previoustimevalue = timevalue;
+		timemoved = 0;
+		block++;
+	}
+			
+	if ((tap == 1 && abs(previoustimevalue-timevalue) >= 15) || (timepresetactive == 1 && tap == 0 && abs(previoustimevalue-timevalue) >= 15) || (timepresetactive == 0 && tap == 0 && timemoved))//if pot move of more than 5%, changing to pot control
+	{
+		if (cleanmode == 1)		//if clean mode active time pot course divided per 2
 		{
-			if (inc <=127){currentinc = 0;}
-			else{currentinc = 400;}
+			cleantimevalue = (timevalue*127)/255;
+			SPI_Queue(cleantimevalue, GLIDE_POT);
+			mstempo = cleantimevalue;	//mstempo used to stock directly digi pot wiper position (for presets)
 		}
-	
-		if (wavetype == 2)	//Triangle
+		else
 		{
-			if (inc <= 127){currentinc = round((400 / 127) * inc);}
-			else{currentinc = round((400 / 127) * (127 - (inc - 128)));}
+			SPI_Queue(timevalue, GLIDE_POT);
+			mstempo = timevalue;	//mstempo used to stock directly digi pot wiper position (for presets)
 		}
 		
-		if (wavetype == 3){currentinc = round((400 / 255)* inc);}	//Sawtooth
-		
-		if (wavetype == 4){currentinc = round((400 / 255) * (255-inc));}	//Reverse Sawtooth
-		
-		if (wavetype == 5 && (inc%50) == 0){currentinc = rand() / (RAND_MAX / 401);}	//random
-		
-		
+		previoustimevalue = timevalue;
+		timepresetactive = 0;
+		tap = 0;
+	}
+	
+	if (tap == 0){journalchange(0, mstempo);}	//save tap = 0 and the wiper position (stocked in mstempo) when the pot stops moving
+	
+	
+	//-------------TIME DIVISION
+	
+	position = divtogglevalue;
+	if (position != previousdiv && block >= BLOCK_RUNS)		//if first time or if div toggle changed position : update div
+	{
+		if (debounce() == 0)	//if tap button not pressed while changing 3 first div
+		{
+			if (position == 0){divindex = 0;}	//fourth
 		
-		//---------DOUBLE TIME
+			if (position == 1){divindex = 1;}	//dotted eighth
+			
+			if (position == 2){divindex = 2;}	//eighth
+		}
 		
-		if (doubletime() != previousdoubletime)
+		if (debounce() == 1)	//if tap button pressed while changing 3 last div
 		{
-			if (doubletime()==1){divmult /= 2;}
-			else{divmult *= 2;}
-				if (tap == 1)
-				{
-					divtempo = round(mstempo * divmult);
-					if (divtempo > delaymax)
-					{
-						divtempo = delaymax;
-						mstempo = delaymax / divmult;
-					}
-					data = findClosest(divtempo + useroffset[(int)((divtempo+50)/100)]);
-					SPI_Transmit(data);
-				}
-			previousdoubletime = doubletime();
+			if (position == 0){divindex = 3;}	//triplet
+			
+			if (position == 1){divindex = 4;}	//sixteenth
+			
+			if (position == 2){divindex = 5;}	//sextuplet
+			
+			nbtap = 0;			//don't count press as tap
+			tapping = 0;
+			tapstart = getms();
+			laststate = 1;
 		}
 		
+		divapply();		//if in tap control, update digital pot value
 		
+		beatstart = getms();
+		syncreset = 1;
+		previousdiv = position;	//reseting previousdiv to detect next move
+	}
+}
+
+void tasktap(void)		//tap tempo, run on every pass so taps are seen as soon as the interrupt latched them
+{
+	uint32_t interval;		//time between the last 2 taps in us
+	
+	//---------------TAP TEMPO
+	
+	if (debounce()==1 && laststate==0 && nbtap==0 && block >= BLOCK_RUNS) //first tap
+	{
+		lasttaptime = gettap();	//starts counting from the press
+		tapstart = getms();
+		nbtap++;
+		laststate = 1;
+		tapping = 1;
+	}
+	
+	if (nbtap > 1 && (uint16_t)(getms() - tapstart) > (3*mstempo) && debounce()==0 && laststate==0) //if too long between taps  : resets
+	{
+		tapstart = getms();
+		nbtap = 0;
+		tapping = 0;
+		journalchange(1, mstempo);
+	}
+	
+	if (nbtap == 1 && (uint16_t)(getms() - tapstart) > (undivide(cal.delaymax, divmult) + 800) && debounce()==0 && laststate==0) //if tapped only once, reset once the max tempo for the div + 800ms passed
+	{
+		tapstart = getms();
+		nbtap = 0;
+		tapping = 0;
+		journalchange(1, mstempo);
+	}
+	
+	if (debounce()==0 && laststate ==1 && menu == MENU_IDLE)	//release tap button (menus use the release themselves)
+	{
+		laststate = 0;
+		ledoff();
+	}
+	
+	if (debounce()==1 && laststate==0 && nbtap!=0) //not first tap
+	{
+		interval = gettap() - lasttaptime;	//press to press time in us
+		lasttaptime += interval;
 		
+		if (nbtap == 1)		//if second tap, tempo = time elapsed between the 2 button press
+		{
+			tapcount = 0;
+			tapnext = 0;
+			tapheld = 0;
+		}
+		tapadd(interval);	//if not second tap, robust mean of the last taps
 		
-		//----------DELAY TIME POT
+		mstempo = (tapestimate + 500) / 1000;
+		wipercache();		//every division of the new tempo, from the same mstempo as a later div change
+		cachesend(GLIDE_TAP);		//sending wiper position to digital pot, tempo brought down if the division is over delaymax
+
+		nbtap++;			//updating number of tap and last state of tap button
+		laststate = 1;
+		tapstart = getms();			//reseting timeout counter
+		beatstart = tapstart;
+		syncreset = 1;			//synced LFO restarts on the tap too
+		tap = 1;			//now in tap control mode
+		ledon();
+	}
+}
+
+void menupick(uint8_t slot, uint8_t save)	//recalls or saves a preset slot at once, then waits for taps stepping to a further one
+{
+	menuslot = slot;
+	menusave = save;
+	menupress = 0;
+	if (save == 1)
+	{
+		eeprom_read_block(&menuundo, (const void *)(PRESET_START + slot * sizeof(struct preset)), sizeof(struct preset));
+		presetsave(slot);
+	}
+	else{presetrecall(slot);}
+	menustage(MENU_PICK, blink(2*(slot + 1), 100, 150) + PICK_WAIT);	//one flash per slot number
+}
+
+void taskmenu(void)		//long press menus : presets recall & save
+{
+	//-----------PRESETS RECALL & SAVE
+	
+	if (menu == MENU_IDLE && debounce()==1 && (uint16_t)(getms() - tapstart) >= 3000 && laststate==1)	//if button pressed more than 3s
+	{
+		ledoff();
+		menustage(MENU_RECALL1, blink(2, 150, 0) + 1300);
+	}
+	
+	switch (menu)	//each stage waits for the button release without stopping the loop
+	{
+		case MENU_RECALL1:
+		if (debounce()==0)
+		{
+			menupick(0, 0);	//if button released recall preset one, taps then step to a further one (if it has already been saved)
+		}
+		else if (menuexpired()){menustage(MENU_RECALL2, blink(4, 150, 0) + 1300);}	//if button still not released
+		break;
 		
-		if(block < 200)	//blocks the tap button input, div update and the delay time input for 200 loops. This helps stabilizing the save tempo and preset recall.
+		case MENU_RECALL2:
+		if (debounce()==0)	//if button released recall preset 2
 		{
-			previoustimevalue = timevalue;
-			block++;
+			menupick(1, 0);	//(recall only if preset 2 has previously been saved)
 		}
-				
-		if ((tap == 1 && abs(previoustimevalue-timevalue) >= 15) || (timepresetactive == 1 && tap == 0 && abs(previoustimevalue-timevalue) >= 15) || (timepresetactive == 0 && tap == 0 && abs(previoustimevalue-timevalue) >= 1))//if pot move of more than 5%, changing to pot control
+		else if (menuexpired())	//if button still pressed
 		{
-			if (cleanmode == 1)		//if clean mode active time pot course divided per 2
-			{
-				cleantimevalue = (timevalue*127)/255;
-				SPI_Transmit(cleantimevalue);
-				mstempo = cleantimevalue;	//mstempo used to stock directly digi pot wiper position (for presets)
-			}
-			else
-			{
-				SPI_Transmit(timevalue);
-				mstempo = timevalue;	//mstempo used to stock directly digi pot wiper position (for presets)
-			}
-			
-			previoustimevalue = timevalue;
-			timepresetactive = 0;
-			tap = 0;
-			TCNT1 = 0;
+			ledon();	//reverse blink (writing mode)
+			menustage(MENU_SAVE1, blink(2, 150, 500) + 1300);
 		}
+		break;
 		
-		if (tap == 0 && TCNT1 >=800)
+		case MENU_SAVE1:
+		if (debounce()==0)	//if button released save preset 1
 		{
-			eeprom_update_byte((uint8_t*)1, 0);	//write tap = 0 to eeprom when the pot stops moving
-			eeprom_update_word((uint16_t*)2, mstempo);	//Using ms tempo to stock digi pot wiper position
+			menupick(0, 1);
 		}
+		else if (menuexpired()){menustage(MENU_SAVE2, blink(4, 150, 0) + 1300);}	//if button still not released
+		break;
 		
+		case MENU_SAVE2:
+		if (debounce()==0)	//if button released save preset 2
+		{
+			menupick(1, 1);
+		}
+		else if (menuexpired()){menustage(MENU_CANCEL, blink(6, 100, 0));}	//still pressed : nothing done
+		break;
 		
-		
-		//-------------TIME DIVISION
-		
-		if (abs(previousdiv - divtogglevalue) > 50 && block >= 200)		//if first time or if div toggle changed position : update div
+		case MENU_PICK:
+		if (debounce()==1 && menupress==0)	//each tap moves 2 slots up : slots 0,2,4,6 from the first stages, 1,3,5,7 from the second ones
 		{
-			if (debounce() == 0)	//if tap button not pressed while changing 3 first div
+			ledoff();
+			if (menuslot + 2 < PRESETS)
 			{
-				if (divtogglevalue <= 50){divmult = 1;}	//fourth
-			
-				if (divtogglevalue > 50 && divtogglevalue < 230){divmult = 0.75;}	//dotted eighth
-				
-				if (divtogglevalue >= 230){divmult = 0.5;}	//eighth
+				if (menusave == 1){eeprom_update_block(&menuundo, (void *)(PRESET_START + menuslot * sizeof(struct preset)), sizeof(struct preset));}	//the save moves with the step
+				menupick(menuslot + 2, menusave);
 			}
-			
-			if (debounce() == 1)	//if tap button pressed while changing 3 last div
-			{
-				if (divtogglevalue <= 50){divmult = 0.333333;}	//triplet
-				
-				if (divtogglevalue > 50 && divtogglevalue < 230){divmult = 0.25;}	//sixteenth
-				
-				if (divtogglevalue >= 230){	divmult = 0.1666666;}	//sextuplet
-				
-				nbtap = 0;			//don't count press as tap
-				tapping = 0;
-				msturns = 0;
-				laststate = 1;
-			}
-			
-			if (doubletime()==1){divmult /= 2;}
-			
-			if (tap == 1)	//if in tap control, update digital pot value
-			{
-				divtempo = round(mstempo * divmult);
-				if (divtempo > delaymax)
-				{
-					divtempo = delaymax;
-					mstempo = delaymax / divmult;
-				}
-				data = findClosest(divtempo + useroffset[(int)((divtempo+50)/100)]);
-				SPI_Transmit(data);
-			}
-			
-			ledturns = 0;
-			previousdiv = divtogglevalue;	//reseting previousdiv to detect next move
+			else{menustage(MENU_PICK, blink(2, 80, 0) + PICK_WAIT);}	//last slot already
+			menupress = 1;
 		}
-		
-		
-		
-		
-		
-		//---------------TAP TEMPO
-		
-		if (debounce()==1 && laststate==0 && nbtap==0 && block >= 200) //first tap
+		else if (debounce()==0)
 		{
-			TCNT1 = 0;			//starts counting
-			msturns=0;
-			nbtap++;
-			laststate = 1;
-			tapping = 1;
+			menupress = 0;
+			if (menuexpired()){menustage(MENU_CONFIRM, 0);}	//no more taps
 		}
+		break;
 		
-		if (nbtap > 1 && msturns > (3*mstempo) && debounce()==0 && laststate==0) //if too long between taps  : resets
+		case MENU_CANCEL:
+		case MENU_CONFIRM:
+		if (menuexpired())
 		{
-			msturns = 0;
+			menu = MENU_IDLE;
+			tapstart = getms();	//reset tap sequence since this press is not to set tempo
 			nbtap = 0;
 			tapping = 0;
-			eeprom_update_word((uint16_t*)2, mstempo);
-			eeprom_update_byte((uint8_t*)1, 1);
 		}
+		break;
+	}
+}
+
+void taskled(void)
+{
+	//---------LED CONTROL
+	
+	if (blinking() == 0)	//menu blink patterns own the LED while they run
+	{
+		if (tap != 1 && tapping == 0){ledon();} //if button controlled  : LED on 
 		
-		if (nbtap == 1 && msturns > ((delaymax/divmult) + 800) && debounce()==0 && laststate==0) //if tapped only once, reset once the max tempo for the div + 800ms passed
-		{
-			msturns = 0;
-			nbtap = 0;
-			tapping = 0;
-			eeprom_update_word((uint16_t*)2, mstempo);
-			eeprom_update_byte((uint8_t*)1, 1);
-		}
+		if (tapping == 1 && nbtap == 1 && laststate == 1){ledoff();}	//keep the light off when long button press
 		
-		if (debounce()==0 && laststate ==1)	//release tap button
-		{
-			laststate = 0;
-			LEDPORT &= ~(1<<LEDPIN);
+		if (tap == 1 && tapping == 0 && debounce()==0)
+		{	
+			beatled(mstempo);
 		}
-		
-		if (debounce()==1 && laststate==0 && nbtap!=0) //not first tap
-		{
-			if (TCNT1 >= 500){msturns++;}	//round up value if timer counter more than 500µs
-			
-			if (nbtap == 1)		//if second tap, tempo = time elapsed between the 2 button press
-			{
-				divtempo = msturns * divmult;
-				mstempo = msturns;
-			}
-			
-			else		//if not second tap, average every tap
-			{
-				divtempo = round((divtempo + (msturns*divmult)) / 2);
-				mstempo = round((mstempo + msturns)/2);
-			}
-			
-			if (divtempo > delaymax)
-			{
-				divtempo = delaymax;
-				mstempo = delaymax / divmult;
-			}
+	}
+}
+
+struct task		//scheduler entry, see schedule()
+{
+	void (*run)(void);
+	uint8_t period;		//ms between 2 runs, 0 : every pass of the loop
+	uint8_t deadline;	//ms after its due time a run may start, every pass tasks : ms between 2 passes
+	uint16_t next;		//msclock of the next run, every pass tasks : of the last run
+	uint16_t wcet;		//longest run seen, in us
+	uint16_t overruns;	//runs started after their deadline, dropped runs included, stops at 0xFFFF
+};
 
-			data = findClosest(divtempo + useroffset[(int)((divtempo+50)/100)]);			//wiper position returned by position in array
-			SPI_Transmit(data);		//sending wiper position to digital pot
+struct task tasks[TASKS] = {	//in priority order, the modulation path first
+	{taskmod, 1, 1, 0, 0, 0},
+	{tasktap, 0, 2, 0, 0, 0},
+	{taskled, 1, 2, 0, 0, 0},
+	{taskpots, 5, 5, 0, 0, 0},
+	{taskmenu, 10, 10, 0, 0, 0},
+	{journaltask, 10, 10, 0, 0, 0}};
 
-			nbtap++;			//updating number of tap and last state of tap button
-			laststate = 1;
-			TCNT1 = 0;			//reseting counter and ms
-			msturns = 0;
-			ledturns = 0;
-			tap = 1;			//now in tap control mode
-			LEDPORT |= (1<<LEDPIN);
+void schedule(void)		//runs the tasks that are due, keeps their worst case execution time and counts the deadlines missed
+{
+	struct task *t;
+	uint16_t now;
+	uint16_t late;		//ms between the due time and the start of the run
+	uint16_t took;
+	
+	for (t = tasks; t < tasks + TASKS; t++)
+	{
+		now = getms();
+		late = now - t->next;
+		if (t->period != 0)
+		{
+			if ((int16_t)late < 0){continue;}	//not due yet
+			t->next += t->period;
+			if ((int16_t)(now - t->next) >= 0){t->next = now + t->period;}	//more than a period late : runs missed are dropped, deadlines are never over a period so it counts as an overrun
 		}
+		else{t->next = now;}
+		if (late > t->deadline && t->overruns != 0xFFFF){t->overruns++;}
 		
-		
-		
-		//-----------PRESETS RECALL & SAVE
-		
-		if (debounce()==1 && msturns >= 3000 && laststate==1)	//if button pressed more than 3s
+		took = getus();
+		t->run();
+		took = (uint16_t)getus() - took;
+		if (took > t->wcet){t->wcet = took;}
+	}
+}
+
+void idle(void)		//sleeps until the next ms tick or tap edge when no task is due, other interrupts (the pwm one every 32us) send the CPU straight back to sleep
+{
+	struct task *t;
+	uint16_t now = getms();
+	uint8_t state = tapstate;
+	
+	for (t = tasks; t < tasks + TASKS; t++)
+	{
+		if (t->period != 0 && (int16_t)(now - t->next) >= 0){return;}	//every pass tasks wait for the next tick or tap
+	}
+	
+	cli();
+	while (now == msclock() && state == tapstate)	//no tick or tap since the check, or its interrupt would have been missed
+	{
+		sleep_enable();
+		sei();			//sleep_cpu() runs before any interrupt taken after sei()
+		sleep_cpu();
+		sleep_disable();
+		cli();
+	}
+	sei();
+}
+
+uint8_t powerup(void)	//hardware & saved settings, before the interrupts are enabled ; returns the calibration status
+{
+	uint8_t calibrated = eeprom_read_byte((uint8_t *)200);	//reads if already calibrated
+	
+	IOinit();
+	Timerinit();
+	ADCinit();
+	
+	cleanmode = eeprom_read_byte((uint8_t*)0);	//read clean mode status from eeprom
+	previousdoubletime = doubletime();
+	
+	if (journalread() == 1)	//last tempo saved
+	{
+		tap = journaltap;
+		mstempo = journaltempo;
+	}
+	else					//nothing journaled yet : tempo saved at fixed addresses by older firmware
+	{
+		tap = eeprom_read_byte((uint8_t*)1);
+		mstempo = eeprom_read_word((uint16_t*)2);
+		journaltap = tap;
+		journaltempo = mstempo;
+	}
+	
+	presetmigrate(calibrated == 13);	//presets of older firmware moved to the preset bank
+	
+	lfopublish();	//first LFO settings
+	return(calibrated);
+}
+
+void loopstart(void)	//once calibrated : correction curve, clean mode limit, first wiper position & task periods
+{
+	calbuild();		//correction curve from the calibration points, every power up
+	
+	if (cleanmode == 1){cal.delaymax = 600;}	//if in clean mode the maximum delay is now 600ms
+	
+	if (tap != 1){SPI_Queue(mstempo, 0);}
+	else{wipercache();}		//saved tempo in tap control : divisions ready before the div toggle is first read
+	
+	for (uint8_t i = 0; i < TASKS; i++){tasks[i].next = getms();}	//tasks due from now : startup & calibration can last longer than half the 16-bit ms range
+}
+
+int main(void)
+{	
+	_delay_ms(1000); //Waiting for PT2399 to start-up
+	
+	uint8_t calibrated = powerup();
+	uint8_t timecal;
+	int16_t point;			//manual calibration in ms of the current 100ms step
+	uint8_t j = 0;
+	
+	sei();			//activating interrupts, the tap button is read by its interrupt
+	
+
+//--------CLEAN MODE & RE-CALIBRATION 
+
+		if (debounce()==1)
 		{
-			LEDPORT &= ~(1<<LEDPIN);
-			blink1();
-			for (uint16_t y=0; y<=1300;y++)	//wait for button release
+			ledoff();
+			menustage(MENU_CLEAN, blink(2, 150, 0) + 2000);	//if pressed long enough blink
+			
+			while (menu != MENU_IDLE)
 			{
-				_delay_ms(1);
-				if (debounce()==0)
+				blinking();
+				switch (menu)
 				{
-					if (eeprom_read_byte((uint8_t *)32)==1)	//if button released recall preset one (if it has already been saved)
+					case MENU_CLEAN:
+					if (debounce() == 0)	//if button released during the 2s following the blinking
 					{
-						tap = eeprom_read_byte((uint8_t *)33);
-						wavetype = eeprom_read_byte((uint8_t *)34);
-						divmult = eeprom_read_float((float *)35);
-						mstempo = eeprom_read_word((uint16_t *)39);
-						presetdepth = eeprom_read_dword((uint32_t *)41);
-						presetspeed = eeprom_read_byte((uint8_t *)45);
-						if (doubletime()==1){divmult /= 2;}
-						divtempo = (uint16_t) round(mstempo * divmult);
-						if (divtempo > delaymax)
+						switch (cleanmode)
 						{
-							divtempo = delaymax;
-							mstempo = delaymax / divmult;
+							case 0x01:					//toggle the clean mode state and store it to eeprom
+							cleanmode = 0;
+							eeprom_update_byte((uint8_t*)0,0);
+							break;
+							
+							default:
+							cleanmode = 1;
+							eeprom_update_byte((uint8_t*)0,1);
+							break;
 						}
-						if (tap == 1){data = findClosest(divtempo + useroffset[(int)((divtempo+50)/100)]);}
-						else{data = mstempo;}
-						SPI_Transmit(data);
-						speedpresetactive = 1;
-						depthpresetactive = 1;
-						timepresetactive = 1;
-						previousdepth = depthvalue;
-						previousspeed = speedvalue;
-						block=0;	//Blocking delay time pot and tap button to make it stable
+						menustage(MENU_CONFIRM, blink(2, 100, 150) + 150);
 					}
-					_delay_ms(150);
-					fastblink1();
-					_delay_ms(150);
+					else if (menuexpired()){menustage(MENU_RECAL, blink(4, 150, 0) + 2000);}
 					break;
-				}
-			}
-			if (debounce()==1)	//if button still not released
-			{
-				blink1();
-				blink1();
-				for (uint16_t y=0; y<=1300;y++)	//wait for button release
-				{
-					_delay_ms(1);
-					if (debounce()==0)	//if button released recall preset 2
-					{
-						if (eeprom_read_byte((uint8_t *)64)==1)	//(recall only if preset 2 has previously been saved)
-						{
-							tap = eeprom_read_byte((uint8_t *)65);
-							wavetype = eeprom_read_byte((uint8_t *)66);
-							divmult = eeprom_read_float((float *)67);
-							mstempo = eeprom_read_word((uint16_t *)71);
-							presetdepth = eeprom_read_dword((uint32_t *)73);
-							presetspeed = eeprom_read_byte((uint8_t *)77);
-							divtempo = (uint16_t) round(mstempo * divmult);
-							if (doubletime()==1){divmult /= 2;}
-							if (divtempo > delaymax)
-							{
-								divtempo = delaymax;
-								mstempo = delaymax / divmult;
-							}
-							if (tap == 1){data = findClosest(divtempo + useroffset[(int)((divtempo+50)/100)]);}
-							else{data = mstempo;}
-							SPI_Transmit(data);
-							speedpresetactive = 1;
-							depthpresetactive = 1;
-							timepresetactive = 1;
-							previousdepth = depthvalue;
-							previousspeed = speedvalue;
-							block=0;
-						}
-						_delay_ms(150);
-						fastblink1();
-						fastblink1();
-						_delay_ms(150);
-						break;
-						}
-					}
-					if (debounce()==1)	//if button still pressed
+					
+					case MENU_RECAL:
+					if (debounce() == 0)	//if button released during the 2s following the blinking
 					{
-						LEDPORT |= (1<<LEDPIN);	//reverse blink (writing mode)
-						_delay_ms(500);
-						blink1();
-						for (uint16_t y=0; y<=1300;y++)	//wait for button release
-						{
-							_delay_ms(1);
-							if (debounce()==0)	//if button released save preset 1
-							{
-								eeprom_update_byte((uint8_t *)32, 1);
-								eeprom_update_byte((uint8_t *)33, tap);
-								eeprom_update_byte((uint8_t *)34, wavetype);
-								eeprom_update_float((float *)35, divmult);
-								eeprom_update_word((uint16_t *)39, mstempo);
-								eeprom_update_dword((uint32_t *)41, depthvalue);
-								eeprom_update_byte((uint8_t *)45, speedvalue);
-								_delay_ms(150);
-								fastblink1();
-								_delay_ms(150);
-								break;
-							}
-						}
-						if (debounce()==1)	//if button still not released
-						{
-							blink1();
-							blink1();
-							for (uint16_t y=0; y<=1300;y++)	//wait for button release
-							{
-								_delay_ms(1);
-								if (debounce()==0)	//if button released save preset 2
-								{
-									eeprom_update_byte((uint8_t *)64, 1);
-									eeprom_update_byte((uint8_t *)65, tap);
-									eeprom_update_byte((uint8_t *)66, wavetype);
-									eeprom_update_float((float *)67, divmult);
-									eeprom_update_word((uint16_t *)71, mstempo);
-									eeprom_update_dword((uint32_t *)73, depthvalue);
-									eeprom_update_byte((uint8_t *)77, speedvalue);
-									_delay_ms(150);
-									fastblink1();
-									fastblink1();
-									_delay_ms(150);
-									break;
-								}
-							}
-							if (debounce()==1)
-							{
-								fastblink1();
-								fastblink1();
-								fastblink1();
-							}
-						}
+						calibrated = 0;
+						menustage(MENU_CONFIRM, blink(4, 100, 150) + 150);
 					}
+					else if (menuexpired()){menu = MENU_IDLE;}
+					break;
+					
+					default:		//confirmation blink
+					if (menuexpired()){menu = MENU_IDLE;}
+					break;
 				}
-			msturns = 0;	//reset tap sequence since this press is not to set tempo
-			nbtap = 0;
-			tapping = 0;
+			}
 		}
 		
-		
-		
-		//---------LED CONTROL
-		
-		if (tap != 1 && tapping == 0){LEDPORT |= (1<<LEDPIN);} //if button controlled  : LED on 
-		
-		if (tapping == 1 && nbtap == 1 && laststate == 1){LEDPORT &= ~(1<<LEDPIN);}	//keep the light off when long button press
-		
-		if (tap == 1 && tapping == 0 && debounce()==0)
-		{	
-			if (ledturns >= mstempo - 4)	//turns LED on every downbeat
-			{
-				ledturns = 0;
-				LEDPORT |= (1<<LEDPIN);
+	
+	while (adcprimed != 0x1F){}		//waiting for a first value of every pot and toggle (16ms)
+	
+	//-------------CALIBRATION
+	
+	if (calibrated == 13)	//calibrated by a firmware storing floats : convert offsets once (preset divisions are converted by presetmigrate())
+	{
+		j=0;
+		for (uint8_t i = 96; i<=144; i+=4)
+		{
+			eeprom_update_word((uint16_t *)(160 + 2*j), floattofixed(eeprom_read_dword((uint32_t *)i), 0));
+			j++;
+		}
+		calibrated = 14;
+		eeprom_update_byte((uint8_t *)200, 14);
+	}
+	
+	if (calibrated != 14)
+	{
+		cal.delaymax = 1291;
+		calibrated = 3;
+		while(calibrated!=13)
+		{
+			timecal=timevalue;
+			
+			if(calibrated<=11){
+				mstempo = (calibrated+1)*100;
+				point = (((int32_t)timecal * (mstempo/3)) / 255) - (mstempo/6);
+				data = findClosest(mstempo + point);
+				SPI_Queue(data, 0);
+				}
+				
+			else{
+				SPI_Queue(255, 0);
+				cal.delaymax = 1491 - (((uint16_t)timecal*400)/255);
+				mstempo = cal.delaymax;
 			}
-		
-			if (ledturns >= 8)			//turns LED off 4ms after downbeat
+			
+			beatled(mstempo);
+			
+			if (laststate == 1 && debounce()==0){laststate =0;}
+				
+			if (debounce()==1 && laststate == 0)
 			{
-				LEDPORT &= ~(1<<LEDPIN);
+				laststate = 1;
+				if (calibrated <= CAL_LAST){eeprom_update_word((uint16_t *)(160 + 2*calibrated), point);}	//stocks the point to eeprom
+				calibrated++;
 			}
 		}
+		eeprom_update_byte((uint8_t *)200, 14); //stocks calibrated status to eeprom
+		eeprom_update_word((uint16_t*)100, cal.delaymax); //stocks delaymax to eeprom
+	}
+	
+	loopstart();
+	
+    while (1) 
+    {
+		schedule();
+		idle();
     }
 }
@@ -0,0 +1,119 @@
+//Benchmark driver : synthetic pot, toggle & tap streams through the firmware on the host
+//Prints the time taken by each main loop pass and by the interrupts of each ms, and writes an output trace.
+//usage : bench [trace.csv]
+
+#include <stdio.h>
+#include <time.h>
+
+#include "host/firmware.h"
+
+#define BENCH_MS 12000
+
+struct event		//something the player does at a given ms
+{
+	uint32_t ms;
+	uint8_t what;
+	uint16_t value;
+};
+
+enum {PRESS, RELEASE, POT, DOUBLE};
+
+#define PRESSLEN 60		//ms the tap button is held for a tap
+
+struct event script[] = {
+	{1000, PRESS, 0}, {1500, PRESS, 130}, {2000, PRESS, 0}, {2499, PRESS, 500},	//4 taps at 500ms, sub-ms jitter
+	{4000, POT, ADC_DIV << 12 | 512},			//div toggle : dotted eighth
+	{5000, POT, ADC_WAVE << 12 | 1000},			//wave toggle : triangle
+	{6000, POT, ADC_SPEED << 12 | 900},			//speed pot, swept by the pot filter
+	{7500, DOUBLE, 1},
+	{8000, POT, ADC_TIME << 12 | 200},			//time pot : back to pot control
+	{9000, PRESS, 0}, {9350, PRESS, 0}, {9700, PRESS, 0}, {10050, PRESS, 0},
+	{11000, DOUBLE, 0},
+};
+
+static uint64_t nanos(void)
+{
+	struct timespec t;
+	
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return((uint64_t)t.tv_sec * 1000000000ULL + t.tv_nsec);
+}
+
+int main(int argc, char **argv)
+{
+	FILE *trace = NULL;
+	uint8_t next = 0;
+	uint32_t release = 0;		//ms the tap button is let go, 0 if not held
+	uint64_t start, isr, pass;
+	uint64_t isrsum = 0, isrmax = 0, passsum = 0, passmax = 0;
+	uint32_t passes = 0;
+	
+	if (argc > 1 && (trace = fopen(argv[1], "w")) == NULL)
+	{
+		perror(argv[1]);
+		return(1);
+	}
+	if (trace){fprintf(trace, "ms,button,tap,mstempo,divindex,wiper,pwm,led,wave,phaseinc\n");}
+	
+	simfactory();
+	simstart();
+	
+	while (simtime < BENCH_MS)
+	{
+		while (next < sizeof(script) / sizeof(script[0]) && script[next].ms == simtime)
+		{
+			struct event *e = &script[next++];
+			
+			switch (e->what)
+			{
+				case PRESS:
+				simtap(1, e->value);
+				release = simtime + PRESSLEN;
+				break;
+				
+				case POT:
+				simadc[e->value >> 12] = e->value & 0x3FF;
+				break;
+				
+				default:
+				simdouble(e->value);
+				break;
+			}
+		}
+		if (release != 0 && release == simtime)
+		{
+			simtap(0, 0);
+			release = 0;
+		}
+		
+		start = nanos();
+		simms();
+		isr = nanos() - start;
+		
+		start = nanos();
+		schedule();
+		pass = nanos() - start;
+		
+		if (simtime > 100)	//startup passes left out, cold caches
+		{
+			isrsum += isr;
+			passsum += pass;
+			passes++;
+			if (isr > isrmax){isrmax = isr;}
+			if (pass > passmax){passmax = pass;}
+		}
+		
+		if (trace)
+		{
+			fprintf(trace, "%u,%u,%u,%u,%u,%u,%u,%u,%u,%u\n", simtime, tapstate, tap, mstempo, divindex, spilast,
+				(simpwmsum * 1000) / (simpwmperiods * 256), (LEDPORT >> LEDPIN) & 1, wavetype, lfo[lforead].phaseinc);
+		}
+	}
+	if (trace){fclose(trace);}
+	
+	printf("%u ms simulated\n", BENCH_MS);
+	printf("interrupts of one ms : mean %lu ns, max %lu ns\n", (unsigned long)(isrsum / passes), (unsigned long)isrmax);
+	printf("main loop pass : mean %lu ns, max %lu ns\n", (unsigned long)(passsum / passes), (unsigned long)passmax);
+	printf("final : tap %u, mstempo %u ms, divindex %u, wiper %u, wave %u, wiper writes %u\n", tap, mstempo, divindex, spilast, wavetype, spiwrites);
+	return(0);
+}
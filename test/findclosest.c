@@ -0,0 +1,107 @@
+//findClosest() against the binary search it replaced, for every target from -2000 to 4000ms
+//Also counts the flash table reads of both (the cost on the AVR, 3 cycles each plus the loop) and times them on the host.
+
+#include <stdio.h>
+#include <time.h>
+#include <avr/pgmspace.h>
+
+uint32_t reads;		//flash table reads, counted by the pgm_read_* below
+#undef pgm_read_word_near
+#undef pgm_read_byte_near
+#define pgm_read_word_near(address) readword((const uint16_t *)(address))
+#define pgm_read_byte_near(address) readbyte((const uint8_t *)(address))
+
+static uint16_t readword(const uint16_t *address)
+{
+	reads++;
+	return(*address);
+}
+
+static uint8_t readbyte(const uint8_t *address)
+{
+	reads++;
+	return(*address);
+}
+
+#include "host/firmware.h"
+
+#define FIRST -2000
+#define LAST 4000
+
+int searchClosest(int target)	//binary search of the original firmware
+{
+	if (target <= pgm_read_word_near(tempo + 0))
+		return 0;
+	if (target >= pgm_read_word_near(tempo + (N_ARRAY-1)))
+		return N_ARRAY - 1;
+	
+	int i = 0, j = N_ARRAY, mid = 0;
+	while (i < j) {
+		mid = (i + j) / 2;
+		
+		if (pgm_read_word_near(tempo + mid) == target)
+			return mid;
+		
+		if (target < pgm_read_word_near(tempo + mid)) {
+			if (mid > 0 && target > pgm_read_word_near(tempo + (mid - 1)))
+				return getClosest(pgm_read_word_near(tempo + (mid - 1)),
+								  pgm_read_word_near(tempo + mid), target, mid-1, mid);
+			j = mid;
+		}
+		else {
+			if (mid < N_ARRAY - 1 && target < pgm_read_word_near(tempo + (mid + 1)))
+				return getClosest(pgm_read_word_near(tempo + mid),
+								  pgm_read_word_near(tempo + (mid + 1)), target, mid, mid+1);
+			i = mid + 1;
+		}
+	}
+	return mid;
+}
+
+static double nspercall(int (*search)(int))	//host time of one call, averaged over the whole range
+{
+	struct timespec start, end;
+	volatile int sink = 0;
+	int round, target;
+	
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (round = 0; round < 200; round++)
+	{
+		for (target = FIRST; target <= LAST; target++){sink += search(target);}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	(void)sink;
+	return(((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / (200.0 * (LAST - FIRST + 1)));
+}
+
+int main(void)
+{
+	uint32_t mismatches = 0;
+	uint32_t oldsum = 0, newsum = 0, oldmax = 0, newmax = 0;
+	int target, expected, got;
+	
+	for (target = FIRST; target <= LAST; target++)
+	{
+		reads = 0;
+		expected = searchClosest(target);
+		oldsum += reads;
+		if (reads > oldmax){oldmax = reads;}
+		
+		reads = 0;
+		got = findClosest(target);
+		newsum += reads;
+		if (reads > newmax){newmax = reads;}
+		
+		if (got != expected)
+		{
+			if (mismatches < 10){printf("target %d : findClosest %d, binary search %d\n", target, got, expected);}
+			mismatches++;
+		}
+	}
+	
+	printf("findClosest : %u mismatches over %d targets\n", mismatches, LAST - FIRST + 1);
+	printf("flash reads per call : binary search mean %.2f max %u, bucket index mean %.2f max %u\n",
+		(double)oldsum / (LAST - FIRST + 1), oldmax, (double)newsum / (LAST - FIRST + 1), newmax);
+	printf("host time per call : binary search %.1f ns, bucket index %.1f ns\n", nspercall(searchClosest), nspercall(findClosest));
+	return(mismatches != 0);
+}
@@ -0,0 +1,58 @@
+//Residual delay error of tapwiper() over the whole 51 to 1291ms range, on a model of the PT2399 clock shift
+//Model : the pwmfine[] measurements of the original firmware, 5 pwm steps per ms shortening & 4.6 lengthening, taken at
+//PWM_REF ms and scaled as 1/delay since a control voltage shift changes the PT2399 clock by a ratio. No calibration offsets.
+//finetrim[] was derived from the same model, so this only checks the table & tapwiper() against it : the residual is not
+//a measured one, a pedal is only as close as the model is to its PT2399.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "host/firmware.h"
+
+#define PWM_REF 500.0		//delay the pwmfine[] steps were measured at
+#define PWM_SHORTEN 5.0		//pwm steps per ms, positive bias
+#define PWM_LENGTHEN 4.6	//negative bias
+
+static double modeldelay(uint8_t wiper, int8_t trim)	//delay of a wiper position with a mod pwm bias
+{
+	double chart = pgm_read_word_near(tempo + wiper);
+	double perms = (trim > 0 ? PWM_SHORTEN : PWM_LENGTHEN) * PWM_REF / chart;
+	
+	return(chart - trim / perms);
+}
+
+int main(void)
+{
+	double error, trimmedmax = 0, trimmedsum = 0, wipermax = 0, wipersum = 0;
+	uint32_t within = 0;
+	uint16_t target, worst = 0;
+	uint8_t wiper;
+	int8_t trim;
+	
+	simfactory();
+	calbuild();		//flat calibration curve
+	
+	for (target = 51; target <= 1291; target++)
+	{
+		wiper = tapwiper(target, &trim);
+		
+		error = fabs(modeldelay(wiper, trim) - target);
+		trimmedsum += error;
+		if (error > trimmedmax)
+		{
+			trimmedmax = error;
+			worst = target;
+		}
+		if (error <= 1.0){within++;}
+		
+		error = abs((int16_t)pgm_read_word_near(tempo + wiper) - (int16_t)target);
+		wipersum += error;
+		if (error > wipermax){wipermax = error;}
+	}
+	
+	printf("51 to 1291ms, %d targets, delays from the pwm model finetrim[] was built from, not measured\n", 1291 - 51 + 1);
+	printf("wiper alone : max %.2f ms, mean %.2f ms\n", wipermax, wipersum / (1291 - 51 + 1));
+	printf("wiper & pwm trim : max %.2f ms (at %u ms), mean %.2f ms, %u targets within 1ms\n", trimmedmax, worst, trimmedsum / (1291 - 51 + 1), within);
+	return(trimmedmax > 1.0);
+}
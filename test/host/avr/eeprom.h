@@ -0,0 +1,23 @@
+//Host port of <avr/eeprom.h> : the 512 byte eeprom is an array, addresses are the pointer values
+
+#ifndef HOST_AVR_EEPROM_H
+#define HOST_AVR_EEPROM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define E2END 511
+
+extern uint8_t simeeprom[E2END + 1];
+extern uint32_t simeewrites;	//bytes actually written (update calls skip equal bytes)
+
+uint8_t eeprom_read_byte(const uint8_t *address);
+uint16_t eeprom_read_word(const uint16_t *address);
+uint32_t eeprom_read_dword(const uint32_t *address);
+void eeprom_read_block(void *destination, const void *source, size_t length);
+void eeprom_update_byte(uint8_t *address, uint8_t value);
+void eeprom_update_word(uint16_t *address, uint16_t value);
+void eeprom_update_block(const void *source, void *destination, size_t length);
+int eeprom_is_ready(void);
+
+#endif
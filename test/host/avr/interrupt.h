@@ -0,0 +1,19 @@
+//Host port of <avr/interrupt.h> : interrupt vectors are plain functions the simulation calls, see sim.c
+
+#ifndef HOST_AVR_INTERRUPT_H
+#define HOST_AVR_INTERRUPT_H
+
+#define ISR(vector, ...) void vector(void)
+#define ISR_NAKED
+#define ISR_NOBLOCK
+
+void sei(void);
+void cli(void);
+
+void ADC_vect(void);
+void PCINT1_vect(void);
+void TIM1_OVF_vect(void);
+void TIM0_COMPA_vect(void);
+void TIM0_COMPB_vect(void);
+
+#endif
@@ -0,0 +1,31 @@
+//Host port of <avr/io.h> : ATtiny84A registers used by Bontempo_Main.c as plain variables, see sim.c
+
+#ifndef HOST_AVR_IO_H
+#define HOST_AVR_IO_H
+
+#include <stdint.h>
+
+#define REG8(name) extern volatile uint8_t name;
+#define REG16(name) extern volatile uint16_t name;
+
+REG8(PORTA) REG8(PORTB) REG8(DDRA) REG8(DDRB) REG8(PINA) REG8(PINB)
+REG8(USIDR) REG8(USISR) REG8(USICR)
+REG8(TCNT0) REG8(OCR0A) REG8(OCR0B) REG8(TCCR0A) REG8(TCCR0B) REG8(TIMSK0) REG8(TIFR0)
+REG16(TCNT1) REG16(OCR1A) REG8(TCCR1A) REG8(TCCR1B) REG8(TIMSK1)
+REG16(ADC) REG8(ADMUX) REG8(ADCSRA) REG8(ADCSRB)
+REG8(GPIOR0) REG8(GPIOR1) REG8(GPIOR2) REG8(GIMSK) REG8(PCMSK1) REG8(SREG)
+
+enum {PINA0, PINA1, PINA2, PINA3, PINA4, PINA5, PINA6, PINA7};
+enum {PINB0, PINB1, PINB2, PINB3};
+enum {USITC, USICLK, USICS0, USICS1, USIWM0, USIWM1, USIOIF};
+enum {WGM00 = 0, WGM01 = 1, CS00 = 0, CS01 = 1, CS02 = 2, OCIE0A = 1, OCIE0B = 2, OCF0A = 1, OCF0B = 2};
+enum {WGM10 = 0, WGM11 = 1, WGM12 = 3, WGM13 = 4, CS10 = 0, COM1A0 = 6, COM1A1 = 7, TOIE1 = 0};
+enum {ADPS0, ADPS1, ADPS2, ADIE, ADIF, ADATE, ADSC, ADEN};
+enum {ADTS0, ADTS1, ADTS2};
+enum {PCIE0 = 4, PCIE1 = 5, PCINT8 = 0, PCINT9 = 1};
+
+#define _BV(bit) (1 << (bit))
+#define bit_is_set(sfr, bit) ((sfr) & _BV(bit))
+#define bit_is_clear(sfr, bit) (!((sfr) & _BV(bit)))
+
+#endif
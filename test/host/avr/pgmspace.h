@@ -0,0 +1,12 @@
+//Host port of <avr/pgmspace.h> : flash tables are ordinary const data
+
+#ifndef HOST_AVR_PGMSPACE_H
+#define HOST_AVR_PGMSPACE_H
+
+#include <stdint.h>
+
+#define PROGMEM
+#define pgm_read_byte_near(address) (*(const uint8_t *)(address))
+#define pgm_read_word_near(address) (*(const uint16_t *)(address))
+
+#endif
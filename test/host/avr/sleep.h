@@ -0,0 +1,13 @@
+//Host port of <avr/sleep.h> : sleeping does nothing, the simulation drives the clock
+
+#ifndef HOST_AVR_SLEEP_H
+#define HOST_AVR_SLEEP_H
+
+#define SLEEP_MODE_IDLE 0
+
+void set_sleep_mode(int mode);
+void sleep_enable(void);
+void sleep_disable(void);
+void sleep_cpu(void);
+
+#endif
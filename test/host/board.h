@@ -0,0 +1,93 @@
+//Simulated Bontempo board for the host programs : included by firmware.h after the firmware, drives its interrupts 1ms at a time
+//Pots & toggles are 10-bit readings in simadc[] (ADC_TIME...ADC_WAVE), the tap button & double time switch are pins.
+
+#ifndef HOST_BOARD_H
+#define HOST_BOARD_H
+
+#include <string.h>
+
+uint16_t simadc[5] = {512, 100, 512, 512, 100};	//time, div toggle, speed, depth, wave toggle
+uint32_t simtime = 0;		//ms simulated since power up
+uint32_t simpwmsum;			//OCR1A summed over the pwm periods of the last ms
+uint8_t simpwmperiods;		//pwm periods in the last ms
+
+static inline void simfactory(void)	//eeprom of a calibrated unit with no offsets, pot control & no presets
+{
+	memset(simeeprom, 0xFF, sizeof(simeeprom));
+	simeeprom[0] = 0;			//clean mode off
+	simeeprom[1] = 0;			//pot control, wiper 128
+	simeeprom[2] = 128;
+	simeeprom[3] = 0;
+	simeeprom[100] = 1291 & 0xFF;	//delaymax
+	simeeprom[101] = 1291 >> 8;
+	memset(simeeprom + 160, 0, 2*(CAL_LAST + 1));	//calibration points
+	simeeprom[200] = 14;
+}
+
+static inline uint8_t simtickat(void)	//TCNT0 from which the ms tick has happened : a compare flag rises one timer clock after the match, at TOP that is the clock clearing TCNT0
+{
+	return((OCR0B + 1) % (OCR0A + 1));
+}
+
+static inline void simduring(uint16_t us)	//timer state us after the start of the last simulated ms, undone by simresume()
+{
+	TCNT0 = us >> 3;
+	if (TCNT0 < simtickat() && GPIOR0-- == 0 && GPIOR1-- == 0 && GPIOR2-- == 0){mshigh--;}	//tick of that ms still to come
+}
+
+static inline void simresume(void)
+{
+	if (TCNT0 < simtickat()){TIM0_COMPB_vect();}
+	TCNT0 = OCR0A;
+}
+
+static inline void simtap(uint8_t pressed, uint16_t us)	//tap button edge us after the start of the last simulated ms
+{
+	simduring(us);
+	if (pressed){PINB &= ~(1<<BUTTONBV);}	//active low
+	else{PINB |= (1<<BUTTONBV);}
+	PCINT1_vect();
+	simresume();
+}
+
+static inline void simdouble(uint8_t on)
+{
+	if (on){DOUBLESFR |= (1<<DOUBLEBV);}
+	else{DOUBLESFR &= ~(1<<DOUBLEBV);}
+}
+
+static inline void simms(void)		//one timer0 period from the clock clearing TCNT0 : LFO sample, conversion of the last trigger, ms tick when its flag rises, 31.25 pwm periods
+{
+	uint8_t periods = ((simtime + 1) * 125) / 4 - (simtime * 125) / 4;
+	
+	TCNT0 = 0;
+	if (simtickat() == 0){TIM0_COMPB_vect();}
+	TIM0_COMPA_vect();
+	ADC = simadc[pgm_read_byte_near(adcsequence + adcstep)];
+	ADC_vect();
+	if (simtickat() != 0)
+	{
+		TCNT0 = simtickat();
+		TIM0_COMPB_vect();
+	}
+	simpwmsum = 0;
+	simpwmperiods = periods;
+	while (periods--)
+	{
+		TIM1_OVF_vect();
+		simpwmsum += OCR1A;
+	}
+	TCNT0 = OCR0A;
+	simtime++;
+}
+
+static inline void simstart(void)	//power up through the firmware's own startup : main() without the start-up delay, the long press menus & calibration
+{
+	PINB |= (1<<BUTTONBV);	//tap button released
+	powerup();
+	sei();
+	while (adcprimed != 0x1F){simms();}	//first value of every pot & toggle, as main() waits for it
+	loopstart();
+}
+
+#endif
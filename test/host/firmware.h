@@ -0,0 +1,11 @@
+//The whole firmware built into a host program, with the simulated board : its main() is renamed so the program has its own
+
+#ifndef HOST_FIRMWARE_H
+#define HOST_FIRMWARE_H
+
+#define main bontempo_main
+#include "../../Bontempo_Main.c"
+#undef main
+#include "board.h"
+
+#endif
@@ -0,0 +1,100 @@
+//Host port of the avr-libc calls Bontempo_Main.c uses : register storage, eeprom array, interrupt & sleep stubs
+
+#include <string.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/eeprom.h>
+#include <avr/sleep.h>
+#include <util/delay.h>
+
+volatile uint8_t PORTA, PORTB, DDRA, DDRB, PINA, PINB;
+volatile uint8_t USIDR, USISR, USICR;
+volatile uint8_t TCNT0, OCR0A, OCR0B, TCCR0A, TCCR0B, TIMSK0, TIFR0;
+volatile uint16_t TCNT1, OCR1A;
+volatile uint8_t TCCR1A, TCCR1B, TIMSK1;
+volatile uint16_t ADC;
+volatile uint8_t ADMUX, ADCSRA, ADCSRB;
+volatile uint8_t GPIOR0, GPIOR1, GPIOR2, GIMSK, PCMSK1, SREG;
+
+uint8_t simeeprom[E2END + 1];
+uint32_t simeewrites = 0;
+
+void sei(void){SREG |= 0x80;}		//interrupts are only taken when the simulation calls them
+
+void cli(void){SREG &= ~0x80;}
+
+void set_sleep_mode(int mode){(void)mode;}
+
+void sleep_enable(void){}
+
+void sleep_disable(void){}
+
+void sleep_cpu(void){}
+
+void _delay_ms(double ms){(void)ms;}
+
+void _delay_us(double us){(void)us;}
+
+static uint16_t eeaddress(const void *address)
+{
+	return((uintptr_t)address & E2END);
+}
+
+uint8_t eeprom_read_byte(const uint8_t *address)
+{
+	return(simeeprom[eeaddress(address)]);
+}
+
+uint16_t eeprom_read_word(const uint16_t *address)
+{
+	uint16_t a = eeaddress(address);
+	
+	return(simeeprom[a] | (simeeprom[(a + 1) & E2END] << 8));	//little endian, as on the AVR
+}
+
+uint32_t eeprom_read_dword(const uint32_t *address)
+{
+	uint16_t a = eeaddress(address);
+	
+	return(eeprom_read_word((const uint16_t *)(uintptr_t)a) | ((uint32_t)eeprom_read_word((const uint16_t *)(uintptr_t)(a + 2)) << 16));
+}
+
+void eeprom_read_block(void *destination, const void *source, size_t length)
+{
+	uint16_t a = eeaddress(source);
+	size_t i;
+	
+	for (i = 0; i < length; i++){((uint8_t *)destination)[i] = simeeprom[(a + i) & E2END];}
+}
+
+void eeprom_update_byte(uint8_t *address, uint8_t value)
+{
+	uint16_t a = eeaddress(address);
+	
+	if (simeeprom[a] != value)
+	{
+		simeeprom[a] = value;
+		simeewrites++;
+	}
+}
+
+void eeprom_update_word(uint16_t *address, uint16_t value)
+{
+	uint16_t a = eeaddress(address);
+	
+	eeprom_update_byte((uint8_t *)(uintptr_t)a, value);
+	eeprom_update_byte((uint8_t *)(uintptr_t)((a + 1) & E2END), value >> 8);
+}
+
+void eeprom_update_block(const void *source, void *destination, size_t length)
+{
+	uint16_t a = eeaddress(destination);
+	size_t i;
+	
+	for (i = 0; i < length; i++){eeprom_update_byte((uint8_t *)(uintptr_t)((a + i) & E2END), ((const uint8_t *)source)[i]);}
+}
+
+int eeprom_is_ready(void)
+{
+	return(1);
+}
@@ -0,0 +1,21 @@
+//Host port of <util/crc16.h> : same polynomial (0xA001) as the avr-libc one
+
+#ifndef HOST_UTIL_CRC16_H
+#define HOST_UTIL_CRC16_H
+
+#include <stdint.h>
+
+static inline uint16_t _crc16_update(uint16_t crc, uint8_t a)
+{
+	uint8_t i;
+	
+	crc ^= a;
+	for (i = 0; i < 8; ++i)
+	{
+		if (crc & 1){crc = (crc >> 1) ^ 0xA001;}
+		else{crc = (crc >> 1);}
+	}
+	return(crc);
+}
+
+#endif
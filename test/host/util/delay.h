@@ -0,0 +1,9 @@
+//Host port of <util/delay.h> : busy waits return at once
+
+#ifndef HOST_UTIL_DELAY_H
+#define HOST_UTIL_DELAY_H
+
+void _delay_ms(double ms);
+void _delay_us(double us);
+
+#endif
@@ -0,0 +1,111 @@
+#!/bin/sh
+# Checks the interrupt handlers of Bontempo_Main.c against the cycle budgets in isrcycles.txt, read only
+# Builds with avr-gcc like the release build, counts the worst case cycles of each handler in the avr-objdump listing
+# (AVRe timings of the ATtiny84A, see isrcycles.txt) and fails if one is over its budget or has none.
+# --print : only prints the counts, to record them in isrcycles.txt
+# Skipped when the avr toolchain is not installed.
+
+cd "$(dirname "$0")" || exit 1
+BUDGETS=isrcycles.txt
+ELF=isrcycles.elf
+LISTING=isrcycles.lst
+PRINT=0
+[ "$1" = "--print" ] && PRINT=1
+
+if ! command -v avr-gcc >/dev/null 2>&1 || ! command -v avr-objdump >/dev/null 2>&1
+then
+	echo "isrcycles: avr-gcc or avr-objdump not found, skipped"
+	exit 0
+fi
+
+avr-gcc -mmcu=attiny84a -Os -std=gnu99 -o "$ELF" ../Bontempo_Main.c || exit 1
+avr-objdump -d "$ELF" > "$LISTING" || exit 1
+
+awk -v budgets="$BUDGETS" -v print_only="$PRINT" '
+	function hex(s,    i, v) {		# no strtonum in every awk
+		sub(/^0x/, "", s); v = 0
+		for (i = 1; i <= length(s); i++) v = v * 16 + index("0123456789abcdef", substr(s, i, 1)) - 1
+		return v
+	}
+	function cost(f,    i, j, c, total, extra, body, t) {
+		if (f in memo) return memo[f]
+		if (!(f in count)) { printf("%s: not found in the listing\n", f); failed = 1; return 0 }
+		if (f in visiting) { printf("%s: recursive, no bound\n", f); failed = 1; return 0 }
+		visiting[f] = 1
+		total = 0
+		for (i = 1; i <= count[f]; i++)
+		{
+			c = cycles[op[f, i]]
+			if (!(op[f, i] in cycles)) { printf("%s: unknown instruction %s\n", f, op[f, i]); failed = 1 }
+			if (op[f, i] ~ /^(icall|ijmp)$/) { printf("%s: indirect %s, no bound\n", f, op[f, i]); failed = 1 }
+			t = target[f, i]
+			if (t != "" && t != f && op[f, i] ~ /^(rcall|call|rjmp|jmp)$/) c += cost(t)	# call, or jump to another function
+			spent[f, i] = c
+			total += c
+		}
+		extra = 0
+		for (i = 1; i <= count[f]; i++)		# backward branches in the function : loops
+		{
+			if (target[f, i] != f || to[f, i] >= addr[f, i]) continue
+			if (!(f in bound)) { printf("%s: loop at %x without a bound\n", f, addr[f, i]); failed = 1; continue }
+			body = 0
+			for (j = 1; j <= count[f]; j++) if (addr[f, j] >= to[f, i] && addr[f, j] <= addr[f, i]) body += spent[f, j]
+			extra += (bound[f] - 1) * (body + 1)	# one more cycle for the taken branch
+		}
+		delete visiting[f]
+		memo[f] = total + extra
+		return memo[f]
+	}
+	BEGIN {
+		split("add adc sub subi sbc sbci and andi or ori eor com neg sbr cbr inc dec tst clr ser cp cpc cpi mov movw ldi in out lsl lsr rol ror asr swap bst bld sec clc sen cln sez clz sei cli ses cls sev clv set clt seh clh nop sleep wdr sbrc sbrs sbic sbis cpse", one, " ")
+		for (i in one) cycles[one[i]] = 1
+		split("adiw sbiw ld ldd lds st std sts push pop rjmp ijmp sbi cbi", two, " ")
+		for (i in two) cycles[two[i]] = 2
+		cycles["rcall"] = 3; cycles["icall"] = 3; cycles["lpm"] = 3; cycles["call"] = 4; cycles["jmp"] = 3
+		cycles["ret"] = 4; cycles["reti"] = 4
+		while ((getline line < budgets) > 0)
+		{
+			sub(/#.*/, "", line)
+			if (line ~ /^[ \t]*$/) continue
+			split(line, f, /[ \t]+/)
+			if (f[1] == "loop") { bound[f[2]] = f[3]; continue }
+			order[++handlers] = f[2]; name[f[2]] = f[1]; budget[f[2]] = f[3]
+		}
+	}
+	/^[0-9a-f]+ <.*>:$/ {
+		current = $2; gsub(/[<>:]/, "", current)
+		next
+	}
+	current != "" && /^ +[0-9a-f]+:\t/ {
+		split($0, f, "\t")
+		split(f[3], o, /[ \t]+/)
+		gsub(/[ :]/, "", f[1])
+		n = ++count[current]
+		addr[current, n] = hex(f[1])
+		op[current, n] = (o[1] ~ /^br/) ? "brbc" : o[1]
+		if ($0 ~ /; 0x[0-9a-f]+ <[^>]+>/)	# branch, jump & call targets : "; 0x9e <name+0x12>"
+		{
+			match($0, /; 0x[0-9a-f]+ <[^>]+>/)
+			t = substr($0, RSTART + 2, RLENGTH - 2)
+			split(t, parts, /[ <>+]+/)
+			to[current, n] = hex(parts[1])
+			target[current, n] = parts[2]
+		}
+	}
+	END {
+		cycles["brbc"] = 1
+		for (i = 1; i <= handlers; i++)
+		{
+			v = order[i]
+			total = 6 + cost(v)		# 4 to enter, 2 for the rjmp of the vector table
+			if (print_only) printf("%-12s %s\t%d\n", name[v], v, total)
+			else if (budget[v] == "-") { printf("%-12s %4d cycles, no budget recorded\n", name[v], total); failed = 1 }
+			else
+			{
+				printf("%-12s %4d cycles, budget %4d : %s\n", name[v], total, budget[v], total > budget[v] ? "OVER BUDGET" : "ok")
+				if (total > budget[v]) failed = 1
+			}
+		}
+		exit failed
+	}
+' "$LISTING"
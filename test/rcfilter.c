@@ -0,0 +1,86 @@
+//Mod pwm through the board's RC filter (R3, C1) : the original 1kHz pwm against the 31.25kHz dithered one
+//The dithered duty comes from the firmware's pwmwrite() and timer1 overflow interrupt, the RC is solved exactly over each
+//high & low part of every pwm period. Reports the ripple once settled and the time a 300 -> 600 duty step takes to settle to 1%.
+
+#include <stdio.h>
+#include <math.h>
+
+#include "host/firmware.h"
+
+#define VCC 5.0
+#define FROM 300		//duty step, 0 to 999
+#define TO 600
+#define RUN 0.2			//s simulated after the step
+#define TAIL 0.02		//last s of it the ripple is measured over
+
+struct rc
+{
+	double tau;
+	double v;
+	double high;	//voltage at the end of the high & low parts of the last period
+	double low;
+};
+
+static void period(struct rc *f, double length, double duty)	//one pwm period, high first
+{
+	double vhigh = VCC + (f->v - VCC) * exp(-length * duty / f->tau);
+	
+	f->v = vhigh * exp(-length * (1 - duty) / f->tau);
+	f->high = vhigh;
+	f->low = f->v;
+}
+
+static double dithered(void)	//duty of the next 31.25kHz period, as the timer1 compare unit outputs it
+{
+	double duty = (OCR1A + 1) / 256.0;	//fast pwm, non inverting : high for OCR1A + 1 counts
+	
+	TIM1_OVF_vect();	//OCR1A written now is applied from the next period
+	return(duty);
+}
+
+static void run(double tau, uint8_t dither)
+{
+	double length = dither ? 256 / 8e6 : 1e-3;
+	double t, target, span, high = 0, low = VCC, settled = 0;
+	double means[(int)(RUN / (256 / 8e6)) + 2];
+	int n = 0, i;
+	struct rc f = {tau, 0, 0, 0};
+	
+	pwmwrite(FROM);
+	pwmwrite(FROM);		//both buffers
+	for (t = 0; t < 0.5; t += length)	//settled at the first duty
+	{
+		period(&f, length, dither ? dithered() : (FROM + 1) / 1000.0);
+	}
+	
+	pwmwrite(TO);
+	for (t = 0; t < RUN; t += length)
+	{
+		period(&f, length, dither ? dithered() : (TO + 1) / 1000.0);
+		means[n++] = (f.high + f.low) / 2;
+		if (t > RUN - TAIL)
+		{
+			if (f.high > high){high = f.high;}
+			if (f.low < low){low = f.low;}
+		}
+	}
+	
+	target = (high + low) / 2;
+	span = fabs(target - VCC * (FROM + 1) / 1000.0);
+	for (i = 0; i < n; i++)
+	{
+		if (fabs(means[i] - target) > 0.01 * span){settled = (i + 1) * length;}
+	}
+	
+	printf("tau %4.1f ms, %s : ripple %6.1f mV pp, %d -> %d step settles to 1%% in %4.1f ms\n", tau * 1e3,
+		dither ? "31.25kHz dithered" : "1kHz             ", (high - low) * 1e3, FROM, TO, settled * 1e3);
+}
+
+int main(void)
+{
+	run(10e-3, 0);		//R3 1k, C1 10uF as on the board
+	run(10e-3, 1);
+	run(1e-3, 0);		//C1 1uF
+	run(1e-3, 1);
+	return(0);
+}
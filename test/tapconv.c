@@ -0,0 +1,94 @@
+//Tap tempo convergence : tapadd()/tapmedian() against the averaging of the original firmware on generated tap sequences
+//Each sequence is 9 taps on a steady tempo with gaussian timing jitter, one of taps 3 to 8 is late by a sloppy 60ms.
+//The original firmware measured whole ms and took mstempo = (mstempo + interval)/2 from the 3rd tap.
+
+#include <stdio.h>
+#include <math.h>
+
+#include "host/firmware.h"
+
+#define SEQUENCES 2000
+#define TAPS 9
+#define SLOPPY 60000	//us
+
+static uint32_t lcg = 12345;
+
+static double uniform(void)		//deterministic, so the numbers can be reproduced
+{
+	lcg = lcg * 1664525 + 1013904223;
+	return((lcg >> 8) / 16777216.0);
+}
+
+static double gauss(void)
+{
+	double u = 1.0 - uniform(), v = uniform();
+	
+	return(sqrt(-2 * log(u)) * cos(2 * M_PI * v));
+}
+
+static void run(double period, double jitter, uint8_t sloppy)	//mean error in ms after each tap, new estimator & original averaging
+{
+	double errnew[TAPS] = {0}, errold[TAPS] = {0};
+	uint32_t locked[TAPS] = {0};
+	int s, k;
+	
+	for (s = 0; s < SEQUENCES; s++)
+	{
+		int late = sloppy ? 2 + (int)(uniform() * 6) : -1;
+		double previous = 0, now;
+		uint16_t oldms = 0;
+		
+		for (k = 0; k < TAPS; k++)
+		{
+			now = (k + 1) * period + gauss() * jitter + (k == late ? SLOPPY : 0);
+			if (k > 0)
+			{
+				uint32_t interval = (uint32_t)(now - previous);
+				uint16_t ms = (interval + 500) / 1000;
+				
+				if (k == 1)		//second tap starts a new window, as tasktap() does
+				{
+					tapcount = 0;
+					tapnext = 0;
+					tapheld = 0;
+				}
+				tapadd(interval);
+				oldms = (k == 1) ? ms : (oldms + ms + 1) / 2;
+				
+				errnew[k] += fabs(tapestimate - period) / 1000;
+				errold[k] += fabs(oldms - period / 1000);
+				if (fabs(tapestimate - period) < 1000){locked[k]++;}
+			}
+			previous = now;
+		}
+	}
+	
+	printf("%.0fms taps, %.1fms jitter%s\n", period / 1000, jitter / 1000, sloppy ? ", one sloppy tap" : "");
+	for (k = 1; k < TAPS; k++)
+	{
+		printf("  tap %d : estimator %6.2f ms (%3u%% within 1ms)   averaging %6.2f ms\n", k + 1,
+			errnew[k] / SEQUENCES, (locked[k] * 100) / SEQUENCES, errold[k] / SEQUENCES);
+	}
+}
+
+int main(void)
+{
+	uint8_t k;
+	uint8_t failed = 0;
+	
+	tapcount = 0;	//a steady sequence with one sloppy tap must give the exact tempo after every tap
+	tapnext = 0;
+	tapheld = 0;
+	for (k = 1; k < TAPS; k++)
+	{
+		tapadd(k == 4 ? 500000 + SLOPPY : 500000);
+		if (tapestimate != 500000){failed = 1;}
+	}
+	printf("steady 500ms taps with one sloppy tap : %s\n", failed ? "FAILED" : "exact after every tap");
+	
+	run(500000, 1000, 0);
+	run(500000, 5000, 1);
+	run(250000, 3000, 1);
+	run(1000000, 5000, 1);
+	return(failed);
+}
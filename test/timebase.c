@@ -0,0 +1,67 @@
+//Time base : a tap timestamp & getus() read at every timer0 count of a ms must be the ms count times 1000 plus the count in us
+//The ms tick is modelled as on the ATtiny84A, its compare flag rising one timer clock after TCNT0 matches OCR0B.
+//Then getus() must go up 1000us a ms across the wraps of the 3 GPIOR bytes & of the whole 32-bit ms count.
+
+#include <stdio.h>
+#include "host/firmware.h"
+
+int main(void)
+{
+	const uint32_t wraps[2] = {0x00FFFFF0, 0xFFFFFFF0};	//24 & 32-bit ms count wraps
+	uint32_t failures = 0;
+	uint32_t start, expected, now, last;
+	uint16_t us;
+	uint8_t i, w;
+	
+	simfactory();
+	simstart();
+	
+	for (us = 0; us < 1000; us += 8)
+	{
+		simms();
+		start = msclock32() * 1000UL;
+		expected = start + us;
+		
+		simduring(us);
+		now = getus();
+		simresume();
+		if (now != expected)
+		{
+			if (failures < 5){printf("getus() %d us into a ms : %ld us from its start\n", us, (long)(int32_t)(now - start));}
+			failures++;
+		}
+		
+		simtap(1, us);
+		if (gettap() != expected)
+		{
+			if (failures < 5){printf("tap %d us into a ms : timestamped %ld us from its start\n", us, (long)(int32_t)(gettap() - start));}
+			failures++;
+		}
+		for (i = 0; i < 10; i++){simms();}
+		simtap(0, 0);
+		for (i = 0; i < 10; i++){simms();}
+	}
+	
+	for (w = 0; w < 2; w++)
+	{
+		GPIOR0 = wraps[w];
+		GPIOR1 = wraps[w] >> 8;
+		GPIOR2 = wraps[w] >> 16;
+		mshigh = wraps[w] >> 24;
+		last = getus();
+		for (i = 0; i < 32; i++)
+		{
+			simms();
+			now = getus();
+			if (now - last != 1000)
+			{
+				if (failures < 5){printf("getus() %ld us after the last ms, ms count %08lx\n", (long)(int32_t)(now - last), (unsigned long)msclock32());}
+				failures++;
+			}
+			last = now;
+		}
+	}
+	
+	printf("time base : %u wrong timestamps over %d timer0 counts & 2 ms count wraps\n", failures, 125);
+	return(failures != 0);
+}